@@ -1,4 +1,8 @@
 #!/bin/bash
 # On Ubuntu:
 # sudo apt-get install build-essential libconfig8-dev libusb-1.0-0-dev
-g++ -g -o gc gtlm-console/gtlm-console.cpp libgtlm/libgtlm.cpp -I libgtlm/ -I/usr/include/libusb-1.0  -lusb-1.0 -lconfig
+LIBGTLM="libgtlm/libgtlm.cpp libgtlm/libgtlm_pool.cpp libgtlm/libgtlm_error.cpp libgtlm/libgtlm_log.cpp libgtlm/libgtlm_trace.cpp libgtlm/libgtlm_pwm.cpp libgtlm/libgtlm_pacer.cpp libgtlm/libgtlm_compositor.cpp libgtlm/libgtlm_loop.cpp libgtlm/libgtlm_metrics.cpp libgtlm/libgtlm_shm.cpp libgtlm/libgtlm_sim.cpp libgtlm/libgtlm_fault.cpp libgtlm/libgtlm_reconnect.cpp libgtlm/libgtlm_broker.cpp libgtlm/libgtlm_sysfs.cpp libgtlm/libgtlm_restore.cpp libgtlm/libgtlm_exporter.cpp libgtlm/libgtlm_schedule.cpp libgtlm/libgtlm_monitor.cpp"
+g++ -g -std=c++17 -o gc gtlm-console/gtlm-console.cpp $LIBGTLM -I libgtlm/ -I/usr/include/libusb-1.0  -lusb-1.0 -lconfig -lpthread -lrt
+g++ -g -std=c++17 -o gtlm-faultbench gtlm-faultbench/gtlm-faultbench.cpp $LIBGTLM -I libgtlm/ -I/usr/include/libusb-1.0  -lusb-1.0 -lconfig -lpthread -lrt
+g++ -g -std=c++17 -o gtlm-startbench gtlm-startbench/gtlm-startbench.cpp $LIBGTLM -I libgtlm/ -I/usr/include/libusb-1.0  -lusb-1.0 -lconfig -lpthread -lrt
+g++ -g -std=c++17 -o gtlm-top gtlm-top/gtlm-top.cpp $LIBGTLM -I libgtlm/ -I/usr/include/libusb-1.0  -lusb-1.0 -lconfig -lpthread -lrt
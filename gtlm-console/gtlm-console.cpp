@@ -25,6 +25,375 @@
 #include <string.h>
 #include <getopt.h>
 #include "libgtlm.h"
+#include "libgtlm_sim.h"
+#ifdef __linux__
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "libgtlm_broker.h"
+#include "libgtlm_exporter.h"
+#include "libgtlm_loop.h"
+#include "libgtlm_monitor.h"
+#include "libgtlm_restore.h"
+#include "libgtlm_schedule.h"
+#include "libgtlm_shm.h"
+
+typedef struct broker_context {
+    libgtlm_broker *broker;
+    int idle_timer;
+    uint64_t idle;              // ns without a lease before exiting, 0 = never
+} broker_context;
+
+typedef struct schedule_context {
+    libgtlm_device *device;
+    libgtlm_schedule *schedule;
+    libgtlm_exporter *exporter;
+    libgtlm_shm *shm;
+    int shm_retry;
+    libgtlm_monitor *monitor;
+} schedule_context;
+
+
+static void broker_accept(libgtlm_loop *loop, int, uint32_t, void *data);
+
+
+static void
+broker_hangup(libgtlm_loop *loop, int fd, uint32_t, void *data)
+{
+    broker_context *context = (broker_context*)data;
+    char byte;
+    ssize_t length = recv(fd, &byte, 1, MSG_DONTWAIT);
+    if (length > 0 || (length < 0 && errno == EAGAIN))
+        return;
+
+    // the client is done with the controller: hand it to the next one
+    libgtlm_loop_remove_fd(loop, fd);
+    libgtlm_broker_release(context->broker);
+    libgtlm_loop_add_fd(loop, libgtlm_broker_get_fd(context->broker),
+        EPOLLIN, broker_accept, context);
+    if (context->idle)
+        libgtlm_loop_set_timer(loop, context->idle_timer, context->idle, 0);
+}
+
+
+// Waiting clients stay in the listen backlog while one holds the lease.
+static void
+broker_accept(libgtlm_loop *loop, int, uint32_t, void *data)
+{
+    broker_context *context = (broker_context*)data;
+    if (libgtlm_broker_serve(context->broker) != LIBUSB_SUCCESS)
+        return;
+
+    libgtlm_loop_remove_fd(loop, libgtlm_broker_get_fd(context->broker));
+    libgtlm_loop_add_fd(loop, libgtlm_broker_get_lease_fd(context->broker),
+        EPOLLIN | EPOLLRDHUP, broker_hangup, context);
+    // never idle while a client holds the descriptor: a new broker would
+    // claim the controller from under it
+    if (context->idle)
+        libgtlm_loop_set_timer(loop, context->idle_timer, 0, 0);
+}
+
+
+static void
+broker_quit(libgtlm_loop *loop, int, void*)
+{
+    libgtlm_loop_quit(loop);
+}
+
+
+static void
+broker_idle(libgtlm_loop *loop, int, void *data)
+{
+    // the timer may have fired in the same wakeup as an accept
+    broker_context *context = (broker_context*)data;
+    if (libgtlm_broker_get_lease_fd(context->broker) < 0)
+        libgtlm_loop_quit(loop);
+}
+
+
+static void
+trace_flush(libgtlm_loop*, int, void*)
+{
+    libgtlm_trace_flush();
+}
+
+
+// Leases the controller to other gtlm processes until interrupted or, with
+// idleExit, until it was not leased for that many seconds. Under socket
+// activation the inherited socket is used and the next client simply
+// starts the broker again.
+static int
+run_broker(uint32_t idleExit)
+{
+    libgtlm_broker *broker = libgtlm_broker_activate();
+    if (broker == NULL)
+        broker = libgtlm_broker_new(GTLM_BROKER_PATH, 0666);
+    if (broker == NULL) {
+        fprintf(stderr, "Could not start the broker on %s\n", GTLM_BROKER_PATH);
+        return 1;
+    }
+
+    libgtlm_loop *loop = libgtlm_loop_new();
+    if (loop == NULL) {
+        libgtlm_broker_free(broker);
+        return 1;
+    }
+
+    broker_context context;
+    context.broker = broker;
+    context.idle_timer = -1;
+    context.idle = idleExit * 1000000000ULL;
+    libgtlm_loop_add_fd(loop, libgtlm_broker_get_fd(broker), EPOLLIN,
+        broker_accept, &context);
+    libgtlm_loop_add_signal(loop, SIGINT, broker_quit, NULL);
+    libgtlm_loop_add_signal(loop, SIGTERM, broker_quit, NULL);
+    libgtlm_loop_add_signal(loop, SIGUSR1, trace_flush, NULL);
+    // one-shot, disarmed while a lease is held and re-armed when it ends:
+    // an idle broker never wakes up
+    if (context.idle)
+        context.idle_timer = libgtlm_loop_add_timer(loop, context.idle, 0,
+            broker_idle, &context);
+
+    int status = libgtlm_loop_run(loop) < 0 ? 1 : 0;
+    libgtlm_loop_free(loop);
+    libgtlm_broker_free(broker);
+    return status;
+}
+
+
+// Pushes the last saved state to the controller as quickly as possible,
+// falling back to the full open and config path when the fast one fails.
+static int
+run_restore()
+{
+    libgtlm_restore_stats stats;
+    int result = libgtlm_restore(&stats);
+    if (result == LIBUSB_SUCCESS) {
+        printf("Restored in %.1f us (%u packets, open %.1f us)\n",
+            stats.total_time / 1e3, stats.packets, stats.open_time / 1e3);
+        return 0;
+    }
+
+    uint64_t start = libgtlm_time_ns();
+    libgtlm_device *device = libgtlm_connect(GTLM_BROKER_PATH);
+    if (device)
+        libgtlm_read_config(device);
+    else
+        device = libgtlm_init_with_config(false);
+    if (device == NULL) {
+        fprintf(stderr, "Led controller not found!\n");
+        return 1;
+    }
+
+    result = libgtlm_sync(device);
+    if (result == LIBUSB_SUCCESS)
+        libgtlm_save_state(device);
+    libgtlm_free(device);
+    if (result < 0)
+        return 1;
+    printf("Restored from config in %.1f us\n",
+        (libgtlm_time_ns() - start) / 1e3);
+    return 0;
+}
+
+
+
+static void
+schedule_reload(libgtlm_loop*, int, uint32_t, void *data)
+{
+    schedule_context *context = (schedule_context*)data;
+    // an unreadable config would leave the scheduled state as the new base;
+    // keep the old rules until the file parses again
+    if (!libgtlm_read_config(context->device))
+        return;
+    if (libgtlm_schedule_load(context->schedule) < 0)
+        fprintf(stderr, "Some schedule rules in ~/.gtlm were skipped\n");
+}
+
+
+static void
+schedule_quit(libgtlm_loop *loop, int, void*)
+{
+    libgtlm_loop_quit(loop);
+}
+
+
+// The loop thread owns the device, so the counters are taken from here.
+static void
+schedule_export(libgtlm_loop*, int, void *data)
+{
+    schedule_context *context = (schedule_context*)data;
+    libgtlm_exporter_collect(context->exporter, context->device);
+}
+
+
+// Publishes the state a rate-limited snapshot left out, e.g. the syncs of
+// libgtlm_schedule_load right after the monitor was attached.
+static void
+schedule_monitor(libgtlm_loop*, int fd, uint32_t, void *data)
+{
+    schedule_context *context = (schedule_context*)data;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        libgtlm_monitor_flush(context->monitor, context->device);
+}
+
+
+// Syncs what one-shot gc runs handed over through shared memory; a frame
+// that failed is tried again a little later.
+static void
+schedule_apply(libgtlm_loop *loop, schedule_context *context)
+{
+    if (libgtlm_shm_apply(context->shm, context->device) < 0)
+        libgtlm_loop_set_timer(loop, context->shm_retry,
+            GTLM_SHM_RETRY * 1000000ULL, 0);
+}
+
+
+static void
+schedule_shm(libgtlm_loop *loop, int fd, uint32_t, void *data)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) == sizeof(count))
+        schedule_apply(loop, (schedule_context*)data);
+}
+
+
+static void
+schedule_shm_retry(libgtlm_loop *loop, int, void *data)
+{
+    schedule_apply(loop, (schedule_context*)data);
+}
+
+
+// Applies the schedule rules from ~/.gtlm until interrupted, picking up
+// edits to the file as they are saved. With metricsDir the counters are
+// also written there for node_exporter.
+static int
+run_schedule(bool forceReset, const char *metricsDir)
+{
+    libgtlm_device *device = NULL;
+    if (!forceReset)
+        device = libgtlm_connect(GTLM_BROKER_PATH);
+    if (device)
+        libgtlm_read_config(device);
+    else
+        device = libgtlm_init_with_config(forceReset);
+    if (device == NULL) {
+        fprintf(stderr, "Led controller not found!\n");
+        return 1;
+    }
+
+    libgtlm_loop *loop = libgtlm_loop_new();
+    libgtlm_schedule *schedule = loop ? libgtlm_schedule_new(device, loop)
+        : NULL;
+    if (schedule == NULL) {
+        libgtlm_loop_free(loop);
+        libgtlm_free(device);
+        return 1;
+    }
+
+    schedule_context context;
+    context.device = device;
+    context.schedule = schedule;
+    context.exporter = NULL;
+    context.shm = NULL;
+    context.monitor = NULL;
+    context.shm_retry = -1;
+    if (metricsDir) {
+        // the timer sets the pace, so the exporter takes every collect
+        context.exporter = libgtlm_exporter_new(metricsDir, 0);
+        if (context.exporter == NULL || access(metricsDir, W_OK) < 0) {
+            fprintf(stderr, "Cannot write metrics to %s\n", metricsDir);
+            libgtlm_exporter_free(context.exporter);
+            libgtlm_schedule_free(schedule);
+            libgtlm_loop_free(loop);
+            libgtlm_free(device);
+            return 1;
+        }
+        libgtlm_loop_add_timer(loop, 1, GTLM_EXPORTER_INTERVAL * 1000000ULL,
+            schedule_export, &context);
+    }
+    const char *home = getenv("HOME");
+    if (home) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/.gtlm", home);
+        libgtlm_loop_watch_file(loop, path, schedule_reload, &context);
+    }
+    libgtlm_loop_add_signal(loop, SIGINT, schedule_quit, NULL);
+    libgtlm_loop_add_signal(loop, SIGTERM, schedule_quit, NULL);
+    libgtlm_loop_add_signal(loop, SIGUSR1, trace_flush, NULL);
+
+    // for gtlm-top; the schedule runs fine without it
+    libgtlm_monitor *monitor = libgtlm_monitor_create(GTLM_MONITOR_NAME, 0644,
+        GTLM_MONITOR_INTERVAL);
+    context.monitor = monitor;
+    int monitorFd = libgtlm_monitor_get_timerfd(monitor);
+    if (monitorFd >= 0)
+        libgtlm_loop_add_fd(loop, monitorFd, EPOLLIN, schedule_monitor,
+            &context);
+    libgtlm_monitor_attach(monitor, device);
+
+    if (libgtlm_schedule_load(schedule) < 0)
+        fprintf(stderr, "Some schedule rules in ~/.gtlm were skipped\n");
+
+    // one-shot gc runs hand their changes over here instead of waiting for
+    // the controller; like the monitor, the schedule runs fine without it
+    context.shm = libgtlm_shm_create(GTLM_SHM_NAME, 0666);
+    int shmFd = libgtlm_shm_get_eventfd(context.shm);
+    if (shmFd >= 0) {
+        libgtlm_shm_attach(context.shm, device);
+        context.shm_retry = libgtlm_loop_add_timer(loop, 0, 0,
+            schedule_shm_retry, &context);
+        libgtlm_loop_add_fd(loop, shmFd, EPOLLIN, schedule_shm, &context);
+    }
+
+    int status = libgtlm_loop_run(loop) < 0 ? 1 : 0;
+    // the last state is written out on free
+    libgtlm_exporter_collect(context.exporter, device);
+    libgtlm_exporter_free(context.exporter);
+    if (monitorFd >= 0)
+        libgtlm_loop_remove_fd(loop, monitorFd);
+    libgtlm_monitor_attach(NULL, device);
+    libgtlm_monitor_close(monitor);
+    if (shmFd >= 0)
+        libgtlm_loop_remove_fd(loop, shmFd);
+    libgtlm_shm_attach(NULL, device);
+    libgtlm_shm_close(context.shm);
+    libgtlm_schedule_free(schedule);
+    libgtlm_loop_free(loop);
+    libgtlm_free(device);
+    return status;
+}
+
+
+// Hands the changes of a one-shot run to a running gc --schedule, which
+// owns the controller; false if none runs. They last until its next
+// transition or reload; ~/.gtlm is left alone.
+static bool
+send_to_schedule(uint8_t enableZones, uint8_t disableZones, int mode,
+    int enabled)
+{
+    libgtlm_shm *shm = libgtlm_shm_open(GTLM_SHM_NAME);
+    if (shm == NULL)
+        return false;
+
+    libgtlm_frame frame;
+    bool sent = false;
+    if (libgtlm_shm_read_confirmed(shm, &frame) != 0) {
+        frame.led_status = (frame.led_status | enableZones) & ~disableZones;
+        if (mode >= 0)
+            frame.led_mode = mode;
+        if (enabled >= 0)
+            frame.enabled = enabled != 0;
+        sent = libgtlm_shm_write(shm, &frame) != 0;
+    }
+    libgtlm_shm_close(shm);
+    return sent;
+}
+#endif
 
 
 void
@@ -48,13 +417,28 @@ void print_usage(const char *name)
     printf(" --front=state      - Set front LEDs [on/off]\n");
     printf(" --mode=mode        - Set LEDs mode [blink/audio/breath/demo/always]\n");
     printf(" --force-reset      - Force device reset\n");
+    printf(" --log=levels       - Log levels, e.g. 'debug' or 'transfer=trace,core=info'\n");
+    printf(" --trace=file       - Write a timeline for chrome://tracing or Perfetto at exit\n");
+#ifdef __linux__
+    printf("                      (--broker and --schedule also on SIGUSR1)\n");
+#endif
+#ifdef __linux__
+    printf(" --broker           - Hand the opened device to other gtlm processes\n");
+    printf(" --idle-exit=sec    - Stop the broker this long after the last client left\n");
+    printf(" --restore          - Quickly re-apply the last saved settings (boot/resume)\n");
+    printf(" --schedule         - Apply the schedule rules from ~/.gtlm until stopped\n");
+    printf("                      (other runs hand it their changes meanwhile;\n");
+    printf("                      it also publishes the counters gtlm-top shows)\n");
+    printf(" --metrics-dir=dir  - With --schedule, keep dir/gtlm.prom updated for node_exporter\n");
+#endif
+    printf(" --capture-profile=file - Write the device's latency profile for the simulator\n");
 }
 
 
 int
 main(int argc, char *argv[])
 {
-    static const char *kOptions = "hvdre:b:s:f:m:";
+    static const char *kOptions = "hvdre:b:s:f:m:p:kox:l:ta:g:";
     static const struct option kLongOptions[] = {
         {"help", no_argument, NULL, 'h'},
         {"version", no_argument, NULL, 'v'},
@@ -65,6 +449,14 @@ main(int argc, char *argv[])
         {"side", required_argument, NULL, 's'},
         {"front", required_argument, NULL, 'f'},
         {"mode", required_argument, NULL, 'm'},
+        {"capture-profile", required_argument, NULL, 'p'},
+        {"broker", no_argument, NULL, 'k'},
+        {"restore", no_argument, NULL, 'o'},
+        {"idle-exit", required_argument, NULL, 'x'},
+        {"log", required_argument, NULL, 'l'},
+        {"schedule", no_argument, NULL, 't'},
+        {"trace", required_argument, NULL, 'a'},
+        {"metrics-dir", required_argument, NULL, 'g'},
         {NULL, no_argument, NULL, 0}
     };
 
@@ -83,6 +475,12 @@ main(int argc, char *argv[])
     bool forceReset = false;
     bool hasEnable = false;
     bool enable = false;
+    const char *profile = NULL;
+    bool broker = false;
+    bool restore = false;
+    uint32_t idleExit = 0;
+    bool schedule = false;
+    const char *metricsDir = NULL;
     int8_t option = 0;
 
     while ((option = getopt_long(argc, argv, kOptions, kLongOptions, NULL)) != -1) {
@@ -168,6 +566,34 @@ main(int argc, char *argv[])
                         fprintf(stderr, "--mode: wrong argument '%s', use 'blink', 'audio', 'breath', 'demo' or 'always'\n", optarg);
                 }
                 break;
+            case 'p':
+                profile = optarg;
+                break;
+            case 'k':
+                broker = true;
+                break;
+            case 'o':
+                restore = true;
+                break;
+            case 'x':
+                idleExit = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                schedule = true;
+                break;
+            case 'g':
+                metricsDir = optarg;
+                break;
+            case 'a':
+                if (libgtlm_trace_start(optarg))
+                    libgtlm_trace_thread_name("gc");
+                else
+                    fprintf(stderr, "--trace: could not start a trace to '%s'\n", optarg);
+                break;
+            case 'l':
+                if (!libgtlm_set_log_levels(optarg))
+                    fprintf(stderr, "--log: wrong argument '%s', use [subsystem=]level,... with levels off/error/warn/info/debug/trace\n", optarg);
+                break;
             default:
                 return 0;
                 break;
@@ -184,10 +610,81 @@ main(int argc, char *argv[])
         return 0;
     }
 
-    device = libgtlm_init(forceReset);
+#ifdef __linux__
+    // The broker and the schedule take these through their loop; block them
+    // before the logger thread starts so that thread cannot catch them.
+    if (broker || schedule) {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &signals, NULL);
+    }
+#endif
+
+    libgtlm_start_error_logger(stderr);
+
+#ifdef __linux__
+    if (broker) {
+        int status = run_broker(idleExit);
+        libgtlm_stop_error_logger();
+        return status;
+    }
+
+    if (restore) {
+        int status = run_restore();
+        libgtlm_stop_error_logger();
+        return status;
+    }
+
+    if (schedule) {
+        int status = run_schedule(forceReset, metricsDir);
+        libgtlm_stop_error_logger();
+        return status;
+    }
+
+    // a running schedule owns the controller: hand it the changes
+    if (!forceReset && !showStatus && !profile
+        && (hasBack || hasSide || hasFront || hasMode || hasEnable)) {
+        uint8_t enableZones = (hasBack && back ? LEDS_BACK : 0)
+            | (hasSide && side ? LEDS_SIDE : 0)
+            | (hasFront && front ? LEDS_FRONT : 0);
+        uint8_t disableZones = (hasBack && !back ? LEDS_BACK : 0)
+            | (hasSide && !side ? LEDS_SIDE : 0)
+            | (hasFront && !front ? LEDS_FRONT : 0);
+        if (send_to_schedule(enableZones, disableZones, hasMode ? mode : -1,
+                hasEnable ? enable : -1))
+            goto normal_exit;
+    }
+
+    // a running broker saves enumerating and claiming the device
+    if (!forceReset)
+        device = libgtlm_connect(GTLM_BROKER_PATH);
+    if (device && !profile)
+        libgtlm_read_config(device);
+    else if (!device)
+#endif
+    device = profile ? libgtlm_init(forceReset)
+        : libgtlm_init_with_config(forceReset);
     if (!device) goto error_no_device;
 
-    libgtlm_read_config(device);
+    if (profile) {
+        // The controller reads back its mode but not its zones: take those
+        // from the last applied state, or from ~/.gtlm without one.
+#ifdef __linux__
+        libgtlm_frame state;
+        if (libgtlm_load_state(&state))
+            device->led_status = state.led_status;
+        else
+#endif
+        libgtlm_read_config(device);
+        if (!libgtlm_sim_capture_profile(device, 1000, profile))
+            fprintf(stderr, "Could not capture a latency profile to %s\n",
+                profile);
+        libgtlm_free(device);
+        goto normal_exit;
+    }
 
     if (showStatus) {
         print_version(argv[0]);
@@ -218,6 +715,7 @@ main(int argc, char *argv[])
         free(name);
         libgtlm_write_config(device);
         libgtlm_free(device);
+        libgtlm_stop_error_logger();
         return 0;
     }
 
@@ -254,5 +752,6 @@ error_no_device:
     printf("Led controller not found!\n");
 
 normal_exit:
+    libgtlm_stop_error_logger();
     return 0;
 }
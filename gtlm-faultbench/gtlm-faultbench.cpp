@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <string.h>
+#include <getopt.h>
+#include "libgtlm.h"
+#include "libgtlm_sim.h"
+#include "libgtlm_fault.h"
+
+
+typedef struct faultbench_options {
+    const char *profile;
+    uint32_t frames;
+    uint32_t rate;
+    uint32_t burst;
+    uint32_t delay;
+    uint32_t interval;
+    uint64_t seed;
+    libgtlm_sync_mode mode;
+} faultbench_options;
+
+typedef struct faultbench_result {
+    uint64_t injected;
+    uint64_t failed;            // syncs that returned an error
+    uint64_t lost;              // frames the LEDs never showed
+    uint64_t split;             // lost frames with only zones or only mode applied
+    uint64_t late;              // frames that overran their slot
+    uint64_t recoveries;
+    uint64_t recover_total;
+    uint64_t recover_max;
+} faultbench_result;
+
+static const int kErrors[] = {
+    LIBUSB_ERROR_TIMEOUT,
+    LIBUSB_ERROR_PIPE,
+    LIBUSB_ERROR_IO,
+    LIBUSB_ERROR_NO_DEVICE,
+    LIBUSB_ERROR_BUSY,
+};
+
+static const uint8_t kModes[] = {
+    MODE_BLINK, MODE_BREATH, MODE_ALWAYS
+};
+
+
+void
+print_usage(const char *name)
+{
+    printf("%s v%d.%d - measures recovery from injected transfer faults\n",
+        name, GTLM_VERSION_MAJOR, GTLM_VERSION_MINOR);
+    printf("Usage:\n");
+    printf(" --help             - Display this information\n");
+    printf(" --profile=file     - Simulator latency profile (see --capture-profile)\n");
+    printf(" --frames=n         - Frames per fault kind [10000]\n");
+    printf(" --rate=n           - Faults per million stages [10000]\n");
+    printf(" --burst=n          - Stages failed in a row per fault [1]\n");
+    printf(" --delay=us         - Also delay faulted stages by this much [0]\n");
+    printf(" --fps=n            - Frame rate [60]\n");
+    printf(" --seed=n           - Random seed [1]\n");
+    printf(" --fire-and-forget  - Sync without read-back\n");
+}
+
+
+static void
+faultbench_advance(void *data, uint64_t ns)
+{
+    libgtlm_sim_advance((libgtlm_sim*)data, ns);
+}
+
+
+static bool
+faultbench_run(const faultbench_options *options, int error, uint8_t stage,
+    faultbench_result *result)
+{
+    memset(result, 0, sizeof(*result));
+
+    libgtlm_sim *sim = libgtlm_sim_new(options->seed);
+    if (options->profile && !libgtlm_sim_load_profile(sim, options->profile)) {
+        fprintf(stderr, "Could not load profile %s\n", options->profile);
+        libgtlm_sim_free(sim);
+        return false;
+    }
+    libgtlm_sim_set_virtual_clock(sim, true);
+
+    libgtlm_fault *fault = libgtlm_fault_new(libgtlm_sim_get_transport(sim),
+        options->seed);
+    libgtlm_fault_set_delay(fault, faultbench_advance, sim);
+    libgtlm_device *device =
+        libgtlm_open_transport(libgtlm_fault_get_transport(fault));
+    libgtlm_set_sync_mode(device, options->mode, 10, 0);
+
+    libgtlm_fault_rule rule;
+    memset(&rule, 0, sizeof(rule));
+    rule.error = error;
+    rule.rate = options->rate;
+    rule.burst = options->burst;
+    rule.delay = options->delay;
+    rule.stages = stage;
+    libgtlm_fault_add_rule(fault, &rule);
+
+    uint64_t random = options->seed;
+    uint64_t next = libgtlm_time_ns();
+    uint64_t failedAt = 0;
+    bool failing = false;
+    for (uint32_t i = 0; i < options->frames; i++) {
+        uint64_t start = next;
+        next += options->interval;
+
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        libgtlm_frame desired;
+        desired.led_status = (random >> 33) & LEDS_ALL;
+        desired.led_mode = kModes[(random >> 40) % 3];
+        desired.enabled = (random >> 50) & 1;
+        device->led_status = desired.led_status;
+        libgtlm_set_led_mode(device, (libgtlm_led_mode)desired.led_mode,
+            desired.enabled);
+
+        int synced = libgtlm_sync(device);
+        uint64_t now = libgtlm_time_ns();
+        if (now > next)
+            result->late++;
+
+        libgtlm_frame shown;
+        libgtlm_sim_get_state(sim, &shown);
+        bool zones = shown.led_status == desired.led_status;
+        bool mode = shown.led_mode == desired.led_mode
+            && shown.enabled == desired.enabled;
+        if (synced < 0)
+            result->failed++;
+        if (!zones || !mode) {
+            result->lost++;
+            if (zones != mode)
+                result->split++;
+        }
+        if (synced < 0 || !zones || !mode) {
+            if (!failing) {
+                failing = true;
+                failedAt = start;
+            }
+        } else if (failing) {
+            uint64_t recovery = now - failedAt;
+            result->recoveries++;
+            result->recover_total += recovery;
+            if (recovery > result->recover_max)
+                result->recover_max = recovery;
+            failing = false;
+        }
+
+        if (now < next)
+            libgtlm_sim_advance(sim, next - now);
+        else
+            next = now;
+    }
+
+    libgtlm_fault_stats stats;
+    libgtlm_fault_get_stats(fault, &stats);
+    result->injected = stats.injected;
+
+    libgtlm_free(device);
+    libgtlm_fault_free(fault);
+    libgtlm_sim_free(sim);
+    // the ring only holds the injected errors; nobody reads them here
+    while (libgtlm_pop_error(NULL))
+        ;
+    return true;
+}
+
+
+static void
+print_result(const char *error, const char *stage,
+    const faultbench_result *result)
+{
+    double mean = result->recoveries
+        ? (double)result->recover_total / result->recoveries / 1e6 : 0.0;
+    printf("%-10s %-5s %9llu %7llu %7llu %7llu %7llu %9llu %9.2f %9.2f\n",
+        error, stage, (unsigned long long)result->injected,
+        (unsigned long long)result->failed, (unsigned long long)result->lost, (unsigned long long)result->split,
+        (unsigned long long)result->late,
+        (unsigned long long)result->recoveries, mean,
+        result->recover_max / 1e6);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    static const char *kOptions = "hp:n:r:b:d:f:s:a";
+    static const struct option kLongOptions[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"profile", required_argument, NULL, 'p'},
+        {"frames", required_argument, NULL, 'n'},
+        {"rate", required_argument, NULL, 'r'},
+        {"burst", required_argument, NULL, 'b'},
+        {"delay", required_argument, NULL, 'd'},
+        {"fps", required_argument, NULL, 'f'},
+        {"seed", required_argument, NULL, 's'},
+        {"fire-and-forget", no_argument, NULL, 'a'},
+        {NULL, no_argument, NULL, 0}
+    };
+
+    faultbench_options options;
+    options.profile = NULL;
+    options.frames = 10000;
+    options.rate = 10000;
+    options.burst = 1;
+    options.delay = 0;
+    options.interval = 1000000000 / 60;
+    options.seed = 1;
+    options.mode = SYNC_CONFIRMED;
+    unsigned long fps;
+    int8_t option = 0;
+
+    while ((option = getopt_long(argc, argv, kOptions, kLongOptions, NULL)) != -1) {
+        switch (option) {
+            case 'p':
+                options.profile = optarg;
+                break;
+            case 'n':
+                options.frames = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options.rate = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                options.burst = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                options.delay = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                // at most one frame per ns, so the interval never reaches 0
+                fps = strtoul(optarg, NULL, 10);
+                if (fps > 1000000000)
+                    fps = 1000000000;
+                if (fps > 0)
+                    options.interval = 1000000000 / fps;
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                options.mode = SYNC_FIRE_AND_FORGET;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    printf("%s sync, %u frames at %u Hz, %u faults per million, burst %u\n",
+        options.mode == SYNC_CONFIRMED ? "confirmed" : "fire-and-forget",
+        options.frames, 1000000000 / options.interval, options.rate,
+        options.burst);
+    printf("%-10s %-5s %9s %7s %7s %7s %7s %9s %9s %9s\n", "error", "stage",
+        "injected", "failed", "lost", "split", "late", "recovered", "mean ms", "max ms");
+
+    faultbench_result result;
+    for (size_t i = 0; i < sizeof(kErrors) / sizeof(kErrors[0]); i++) {
+        if (!faultbench_run(&options, kErrors[i], FAULT_OUT, &result))
+            return 1;
+        print_result(libgtlm_error_name(kErrors[i]), "OUT", &result);
+        if (!faultbench_run(&options, kErrors[i], FAULT_IN, &result))
+            return 1;
+        print_result(libgtlm_error_name(kErrors[i]), "IN", &result);
+    }
+
+    if (options.delay) {
+        if (!faultbench_run(&options, 0, FAULT_OUT | FAULT_IN, &result))
+            return 1;
+        print_result("DELAY", "both", &result);
+    }
+
+    return 0;
+}
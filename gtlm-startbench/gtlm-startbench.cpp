@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <string.h>
+#include <getopt.h>
+#include <algorithm>
+#include <vector>
+#include "libgtlm.h"
+#ifdef __linux__
+#include "libgtlm_broker.h"
+#endif
+
+
+typedef struct startbench_times {
+    std::vector<uint64_t> init;         // libgtlm_init alone
+    std::vector<uint64_t> config;       // libgtlm_read_config alone
+    std::vector<uint64_t> sequential;   // the two back to back
+    std::vector<uint64_t> concurrent;   // libgtlm_init_with_config
+    std::vector<uint64_t> connect;      // libgtlm_connect and read_config
+} startbench_times;
+
+
+void
+print_usage(const char *name)
+{
+    printf("%s v%d.%d - compares sequential and concurrent startup\n",
+        name, GTLM_VERSION_MAJOR, GTLM_VERSION_MINOR);
+    printf("Usage:\n");
+    printf(" --help             - Display this information\n");
+    printf(" --runs=n           - Startups of each kind [20]\n");
+#ifdef __linux__
+    printf(" --connect[=path]   - Time startups through a running or socket-activated\n");
+    printf("                      broker against cold ones [%s]\n",
+        GTLM_BROKER_PATH);
+#endif
+}
+
+
+static bool
+run_sequential(startbench_times *times)
+{
+    uint64_t start = libgtlm_time_ns();
+    libgtlm_device *device = libgtlm_init(false);
+    if (device == NULL)
+        return false;
+    uint64_t opened = libgtlm_time_ns();
+    libgtlm_read_config(device);
+    uint64_t end = libgtlm_time_ns();
+    libgtlm_free(device);
+
+    times->init.push_back(opened - start);
+    times->config.push_back(end - opened);
+    times->sequential.push_back(end - start);
+    return true;
+}
+
+
+static bool
+run_concurrent(startbench_times *times)
+{
+    uint64_t start = libgtlm_time_ns();
+    libgtlm_device *device = libgtlm_init_with_config(false);
+    if (device == NULL)
+        return false;
+    uint64_t end = libgtlm_time_ns();
+    libgtlm_free(device);
+
+    times->concurrent.push_back(end - start);
+    return true;
+}
+
+
+static void
+print_times(const char *name, std::vector<uint64_t> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    uint64_t total = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        total += samples[i];
+    printf("%-12s %9.1f %9.1f %9.1f %9.1f\n", name, samples.front() / 1e3,
+        samples[samples.size() / 2] / 1e3, total / 1e3 / samples.size(),
+        samples.back() / 1e3);
+}
+
+
+#ifdef __linux__
+static bool
+run_connect(startbench_times *times, const char *path)
+{
+    uint64_t start = libgtlm_time_ns();
+    libgtlm_device *device = libgtlm_connect(path);
+    if (device == NULL)
+        return false;
+    libgtlm_read_config(device);
+    uint64_t end = libgtlm_time_ns();
+    libgtlm_free(device);
+
+    times->connect.push_back(end - start);
+    return true;
+}
+
+
+// The broker claims the controller only while a client holds the lease, so
+// cold startups interleave with the connects as a baseline; they need the
+// usbfs node and are left out without access to it. The first connect is
+// reported on its own as it includes the activation.
+static int
+bench_connect(uint32_t runs, const char *path)
+{
+    startbench_times times;
+    if (!run_connect(&times, path)) {
+        fprintf(stderr, "No broker answered on %s\n", path);
+        return 1;
+    }
+    uint64_t first = times.connect[0];
+    times.connect.clear();
+
+    // the first open fills the kernel and sysfs location caches
+    bool cold = run_concurrent(&times);
+    times.concurrent.clear();
+
+    for (uint32_t i = 0; i < runs; i++) {
+        if (!run_connect(&times, path)) {
+            fprintf(stderr, "Broker lost during the run\n");
+            return 1;
+        }
+        if (cold && !run_concurrent(&times)) {
+            fprintf(stderr, "Led controller lost during the run\n");
+            return 1;
+        }
+    }
+
+    printf("%u runs, times in us\n", runs);
+    printf("first connect %.1f\n", first / 1e3);
+    printf("%-12s %9s %9s %9s %9s\n", "", "min", "median", "mean", "max");
+    print_times("connect", times.connect);
+    if (!cold) {
+        printf("no cold baseline: could not open the controller directly\n");
+        return 0;
+    }
+    print_times("cold", times.concurrent);
+
+    double connect = times.connect[runs / 2];
+    double concurrent = times.concurrent[runs / 2];
+    printf("median saving %.1f us (%.1f%%)\n", (concurrent - connect) / 1e3,
+        100.0 * (concurrent - connect) / concurrent);
+    return 0;
+}
+#endif
+
+
+int
+main(int argc, char *argv[])
+{
+    static const char *kOptions = "hn:c::";
+    static const struct option kLongOptions[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"runs", required_argument, NULL, 'n'},
+        {"connect", optional_argument, NULL, 'c'},
+        {NULL, no_argument, NULL, 0}
+    };
+
+    uint32_t runs = 20;
+    const char *broker = NULL;
+    int8_t option = 0;
+
+    while ((option = getopt_long(argc, argv, kOptions, kLongOptions, NULL)) != -1) {
+        switch (option) {
+            case 'n':
+                runs = strtoul(optarg, NULL, 10);
+                break;
+#ifdef __linux__
+            case 'c':
+                broker = optarg ? optarg : GTLM_BROKER_PATH;
+                break;
+#endif
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+    if (runs == 0)
+        runs = 1;
+#ifdef __linux__
+    if (broker)
+        return bench_connect(runs, broker);
+#endif
+
+    // the first open fills the kernel and sysfs location caches
+    startbench_times warmup;
+    if (!run_sequential(&warmup)) {
+        fprintf(stderr, "Led controller not found!\n");
+        return 1;
+    }
+
+    // interleaved so drift in bus or disk latency hits both kinds alike
+    startbench_times times;
+    for (uint32_t i = 0; i < runs; i++) {
+        if (!run_sequential(&times) || !run_concurrent(&times)) {
+            fprintf(stderr, "Led controller lost during the run\n");
+            return 1;
+        }
+    }
+
+    printf("%u runs each, times in us\n", runs);
+    printf("%-12s %9s %9s %9s %9s\n", "", "min", "median", "mean", "max");
+    print_times("init", times.init);
+    print_times("config", times.config);
+    print_times("sequential", times.sequential);
+    print_times("concurrent", times.concurrent);
+
+    double sequential = times.sequential[runs / 2];
+    double concurrent = times.concurrent[runs / 2];
+    printf("median saving %.1f us (%.1f%%)\n", (sequential - concurrent) / 1e3,
+        100.0 * (sequential - concurrent) / sequential);
+    return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "libgtlm.h"
+#include "libgtlm_monitor.h"
+
+#define GTLM_TOP_LINES               24
+#define GTLM_TOP_WIDTH               96
+
+static const char *kCommandNames[CMD_COUNT] = {
+    "set_led_status", "set_led_mode", "get_version", "get_led_mode"
+};
+
+static const char *kModeNames[] = {
+    "?", "BLINK", "AUDIO", "BREATH", "DEMO", "ALWAYS"
+};
+
+typedef struct top_screen {
+    char lines[GTLM_TOP_LINES][GTLM_TOP_WIDTH];
+    char shown[GTLM_TOP_LINES][GTLM_TOP_WIDTH];
+    int count;
+    bool redraw;                // terminal output: only rewrite changed lines
+} top_screen;
+
+static volatile sig_atomic_t gQuit = 0;
+
+
+static void
+print_usage(const char *name)
+{
+    printf("%s v%d.%d - live counters of a running gtlm process\n", name,
+        GTLM_VERSION_MAJOR, GTLM_VERSION_MINOR);
+    printf("Usage:\n");
+    printf(" --help             - Display this information\n");
+    printf(" --interval=ms      - Refresh interval [1000]\n");
+    printf(" --name=segment     - Shared memory segment [%s]\n", GTLM_MONITOR_NAME);
+    printf(" --batch            - Print every refresh in full, e.g. to a file\n");
+    printf(" --count=n          - Stop after n refreshes [0 = never]\n");
+    printf("The counters come from gc --schedule; gc --broker only lends the\n");
+    printf("controller out and publishes none.\n");
+}
+
+
+static void
+top_quit(int)
+{
+    gQuit = 1;
+}
+
+
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+static void
+top_line(top_screen *screen, const char *format, ...)
+{
+    if (screen->count == GTLM_TOP_LINES)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(screen->lines[screen->count++], GTLM_TOP_WIDTH, format, args);
+    va_end(args);
+}
+
+
+// Histogram of the samples between two snapshots.
+static void
+top_latency_delta(const libgtlm_latency *now, const libgtlm_latency *before,
+    libgtlm_latency *delta)
+{
+    for (int i = 0; i < GTLM_LATENCY_BUCKETS; i++)
+        delta->buckets[i] = now->buckets[i] - before->buckets[i];
+    delta->sum = now->sum - before->sum;
+    delta->count = now->count - before->count;
+}
+
+
+static void
+top_latency_line(top_screen *screen, const char *name,
+    const libgtlm_latency *now, const libgtlm_latency *before, double seconds)
+{
+    libgtlm_latency delta;
+    top_latency_delta(now, before, &delta);
+    if (delta.count == 0) {
+        top_line(screen, "%-16s %9s %9s %9s %9.1f", name, "-", "-", "-", 0.0);
+        return;
+    }
+    top_line(screen, "%-16s %9.3f %9.3f %9.3f %9.1f", name,
+        libgtlm_latency_quantile(&delta, 0.5) / 1e6,
+        libgtlm_latency_quantile(&delta, 0.9) / 1e6,
+        libgtlm_latency_quantile(&delta, 0.99) / 1e6,
+        delta.count / seconds);
+}
+
+
+static uint64_t
+top_error_total(const libgtlm_monitor_snapshot *snapshot)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < GTLM_ERROR_CODES; i++)
+        total += snapshot->errors[i];
+    return total;
+}
+
+
+// Rates come from the owner's own timestamps, so a late refresh here does
+// not skew them; an owner that stopped syncing shows as idle.
+static void
+top_render(top_screen *screen, const libgtlm_monitor_snapshot *now,
+    const libgtlm_monitor_snapshot *before, bool idle)
+{
+    screen->count = 0;
+    double age = (libgtlm_time_ns() - now->timestamp) / 1e9;
+    // nothing to compare against yet, or nothing new: all deltas are zero
+    double seconds = (now->timestamp - before->timestamp) / 1e9;
+    if (now->published == before->published)
+        seconds = 1.0;
+
+    top_line(screen, "gtlm-top - pid %d, snapshot #%llu, %.1f s old%s",
+        (int)now->pid, (unsigned long long)now->published, age,
+        idle ? " (idle)" : "");
+    top_line(screen, "Zones  back %-3s  side %-3s  front %-3s   mode %s, %s",
+        (now->led_status & LEDS_BACK) ? "ON" : "OFF",
+        (now->led_status & LEDS_SIDE) ? "ON" : "OFF",
+        (now->led_status & LEDS_FRONT) ? "ON" : "OFF",
+        kModeNames[now->led_mode <= MODE_ALWAYS ? now->led_mode : 0],
+        now->enabled ? "enabled" : "disabled");
+
+    uint64_t syncs = now->sync.syncs - before->sync.syncs;
+    uint64_t skipped = now->sync.skipped - before->sync.skipped;
+    top_line(screen, "Syncs  %.1f/s   skipped %.1f%%   verifications %.1f/s   "
+        "drifts %llu", syncs / seconds,
+        syncs + skipped ? 100.0 * skipped / (syncs + skipped) : 0.0,
+        (now->sync.verifications - before->sync.verifications) / seconds,
+        (unsigned long long)now->sync.drifts);
+    top_line(screen, "Errors %.1f/s   total %llu   dropped %llu   losses %llu   "
+        "reconnects %llu%s", (top_error_total(now) - top_error_total(before))
+        / seconds, (unsigned long long)top_error_total(now),
+        (unsigned long long)now->dropped_errors,
+        (unsigned long long)now->reconnect.losses,
+        (unsigned long long)now->reconnect.reconnects,
+        now->reconnect.pending ? "   RECONNECTING" : "");
+
+    char codes[GTLM_TOP_WIDTH] = "";
+    for (int i = 1; i < GTLM_ERROR_CODES; i++) {
+        uint64_t count = now->errors[i] - before->errors[i];
+        if (count == 0)
+            continue;
+        size_t used = strlen(codes);
+        snprintf(codes + used, sizeof(codes) - used, " %s %llu",
+            libgtlm_error_name(-i), (unsigned long long)count);
+    }
+    top_line(screen, "       last interval:%s", codes[0] ? codes : " none");
+
+    top_line(screen, "%s", "");
+    top_line(screen, "%-16s %9s %9s %9s %9s", "Transfer (ms)", "p50", "p90",
+        "p99", "per s");
+    for (int i = 0; i < CMD_COUNT; i++)
+        top_latency_line(screen, kCommandNames[i], &now->latency[i],
+            &before->latency[i], seconds);
+
+    if (!now->has_pacer)
+        return;
+
+    const libgtlm_pacer_stats *pacer = &now->pacer;
+    top_line(screen, "%s", "");
+    top_line(screen, "Pacer  queue %llu   sent %.1f/s   dropped %.1f/s "
+        "(%llu total)", (unsigned long long)(pacer->submitted - pacer->sent
+        - pacer->dropped), (pacer->sent - before->pacer.sent) / seconds,
+        (pacer->dropped - before->pacer.dropped) / seconds,
+        (unsigned long long)pacer->dropped);
+    top_line(screen, "%-16s %9s %9s %9s %9s", "Queued (ms)", "p50", "p90",
+        "p99", "per s");
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+        top_latency_line(screen, libgtlm_priority_name((libgtlm_priority)i),
+            &pacer->classes[i].queued, &before->pacer.classes[i].queued,
+            seconds);
+}
+
+
+static void
+top_show(top_screen *screen)
+{
+    if (!screen->redraw) {
+        for (int i = 0; i < screen->count; i++)
+            printf("%s\n", screen->lines[i]);
+        printf("\n");
+        fflush(stdout);
+        return;
+    }
+
+    // blank out lines the previous frame had and this one does not
+    for (int i = screen->count; i < GTLM_TOP_LINES; i++)
+        screen->lines[i][0] = '\0';
+    for (int i = 0; i < GTLM_TOP_LINES; i++) {
+        if (strcmp(screen->lines[i], screen->shown[i]) == 0)
+            continue;
+        printf("\033[%d;1H%s\033[K", i + 1, screen->lines[i]);
+        strcpy(screen->shown[i], screen->lines[i]);
+    }
+    fflush(stdout);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    static const char *kOptions = "hi:n:bc:";
+    static const struct option kLongOptions[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"interval", required_argument, NULL, 'i'},
+        {"name", required_argument, NULL, 'n'},
+        {"batch", no_argument, NULL, 'b'},
+        {"count", required_argument, NULL, 'c'},
+        {NULL, no_argument, NULL, 0}
+    };
+
+    uint32_t interval = 1000;
+    const char *name = GTLM_MONITOR_NAME;
+    bool batch = !isatty(STDOUT_FILENO);
+    uint32_t count = 0;
+    int8_t option = 0;
+
+    while ((option = getopt_long(argc, argv, kOptions, kLongOptions, NULL)) != -1) {
+        switch (option) {
+            case 'i':
+                if (strtoul(optarg, NULL, 10) > 0)
+                    interval = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'b':
+                batch = true;
+                break;
+            case 'c':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = top_quit;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // single keys, no echo: 'q' quits
+    struct termios saved;
+    bool keys = !batch && isatty(STDIN_FILENO)
+        && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (keys) {
+        struct termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    top_screen *screen = (top_screen*)malloc(sizeof(*screen));
+    if (screen == NULL)
+        return 1;
+    memset(screen, 0, sizeof(*screen));
+    screen->redraw = !batch;
+    if (screen->redraw)
+        printf("\033[?25l\033[2J");
+
+    libgtlm_monitor *monitor = NULL;
+    libgtlm_monitor_snapshot now, before;
+    bool primed = false;
+    for (uint32_t refresh = 0; !gQuit && (count == 0 || refresh < count);
+            refresh++) {
+        // an owner that exited leaves us on its unlinked segment
+        if (monitor && primed && kill(now.pid, 0) < 0 && errno == ESRCH) {
+            libgtlm_monitor_close(monitor);
+            monitor = NULL;
+            primed = false;
+        }
+        if (monitor == NULL)
+            monitor = libgtlm_monitor_open(name);
+
+        libgtlm_monitor_snapshot latest;
+        if (monitor && libgtlm_monitor_read(monitor, &latest)) {
+            bool idle = primed && latest.published == now.published;
+            before = primed ? now : latest;
+            now = latest;
+            primed = true;
+            top_render(screen, &now, &before, idle);
+        } else {
+            screen->count = 0;
+            top_line(screen, "gtlm-top - waiting for gc --schedule to "
+                "publish %s", name);
+        }
+        top_show(screen);
+
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&input, keys ? 1 : 0, interval) > 0) {
+            char key = 0;
+            if (read(STDIN_FILENO, &key, 1) == 1 && (key == 'q' || key == 'Q'))
+                break;
+        }
+    }
+
+    if (screen->redraw)
+        printf("\033[%d;1H\033[?25h\n", screen->count + 1);
+    if (keys)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    libgtlm_monitor_close(monitor);
+    free(screen);
+    return 0;
+}
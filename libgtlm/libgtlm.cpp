@@ -22,49 +22,235 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <chrono>
+#include <thread>
 #include <string.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include "libgtlm.h"
+#include "libgtlm_sysfs.h"
+#ifdef __linux__
+#include "libgtlm_monitor.h"
+#include "libgtlm_restore.h"
+#include "libgtlm_shm.h"
+#endif
 
 
 static const char *gCfgName = "/.gtlm";
-static bool gDebug = false;
+static const char *kTraceCommands[CMD_COUNT] = {
+    "set_led_status", "set_led_mode", "get_version", "get_led_mode"
+};
+static uint64_t (*gClock)(void *data) = NULL;
+static void *gClockData = NULL;
 
+static int libgtlm_sync_confirmed(libgtlm_device *device);
+static bool libgtlm_load_config(config_t *config);
+static void libgtlm_apply_config(libgtlm_device *device);
 
-libgtlm_device*
-libgtlm_init(bool forceReset)
+
+static int
+libgtlm_latency_bucket(uint64_t ns)
 {
-    libgtlm_device *gtlm = NULL;
-    ssize_t lmCount = sizeof(libgtlm_device_ids) / sizeof(libgtlm_device_ids[0]);
-    int owned = 0;
+    uint64_t us = ns / 1000;
+    if (us < 4)
+        return (int)us;
+
+    int octave = 2;
+    while ((us >> (octave + 1)) != 0)
+        octave++;
+    int bucket = (octave - 1) * 4 + (int)((us >> (octave - 2)) & 3);
+    return bucket < GTLM_LATENCY_BUCKETS ? bucket : GTLM_LATENCY_BUCKETS - 1;
+}
+
+
+// Sends the request staged in the device transport and reads the
+// controller reply back. The round trip feeds the per-command RTT estimate.
+static int
+libgtlm_transfer(libgtlm_device *device, libgtlm_command command)
+{
+    uint64_t start = libgtlm_time_ns();
+    int result = device->transport->transfer(device->transport, true);
+    if (libgtlm_trace_enabled())
+        libgtlm_trace_span("transfer", kTraceCommands[command], start,
+            libgtlm_time_ns());
+    if (result == LIBUSB_ERROR_NO_DEVICE)
+        libgtlm_reconnect_begin(device->reconnect);
+    GTLM_LOG(SUBSYSTEM_TRANSFER, LEVEL_TRACE, "command %d: %d after %llu ns",
+        command, result, (unsigned long long)(libgtlm_time_ns() - start));
+    if (result < 0)
+        return result;
+
+    // smoothed RTT and mean deviation, weighted as in RFC 6298
+    libgtlm_rtt *rtt = &device->rtt[command];
+    int64_t sample = libgtlm_time_ns() - start;
+    if (rtt->samples == 0) {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+    } else {
+        int64_t delta = sample - (int64_t)rtt->srtt;
+        rtt->rttvar += ((delta < 0 ? -delta : delta) - (int64_t)rtt->rttvar) / 4;
+        rtt->srtt += delta / 8;
+    }
+    rtt->samples++;
+
+    libgtlm_latency_add(&device->latency[command], sample);
+    return result;
+}
+
+
+// OUT only; the controller's reply is left unread.
+static int
+libgtlm_send(libgtlm_device *device)
+{
+    uint64_t trace = GTLM_TRACE_BEGIN();
+    int result = device->transport->transfer(device->transport, false);
+    GTLM_TRACE_END("transfer", "send", trace);
+    if (result == LIBUSB_ERROR_NO_DEVICE)
+        libgtlm_reconnect_begin(device->reconnect);
+    GTLM_LOG(SUBSYSTEM_TRANSFER, LEVEL_TRACE, "send %02x %02x %02x %02x: %d",
+        device->transport->request->data[1], device->transport->request->data[2],
+        device->transport->request->data[3], device->transport->request->data[4],
+        result);
+    return result;
+}
+
 
+// Swaps in the handle the background reconnect re-opened.
+static int
+libgtlm_resume_adopt(libgtlm_device *device)
+{
+    int fd = -1;
+    libusb_device_handle *handle = libgtlm_reconnect_take(device->reconnect,
+        &fd);
+    if (handle == NULL)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    if (device->handle) {
+        libgtlm_pool_free(&device->pool, device->handle);
+        libusb_release_interface(device->handle, 0x00);
+        libusb_close(device->handle);
+    }
+#ifdef __linux__
+    if (device->fd >= 0)
+        close(device->fd);
+#endif
+    device->handle = handle;
+    device->fd = fd;
+
+    int result = libgtlm_pool_init(&device->pool, device->handle);
+    if (result < 0) {
+        // give the handle back and start over
+        GTLM_REPORT_ERROR(result);
+        libusb_release_interface(device->handle, 0x00);
+        libusb_close(device->handle);
+#ifdef __linux__
+        if (device->fd >= 0)
+            close(device->fd);
+#endif
+        device->handle = NULL;
+        device->fd = -1;
+        libgtlm_reconnect_begin(device->reconnect);
+        return result;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+
+// Adopts a re-opened handle once the background reconnect has one and
+// replays the desired state on it. Called before a request is staged, as
+// the transfer buffers are replaced. A replay that fails stays owed and is
+// tried again on the next call.
+static int
+libgtlm_resume(libgtlm_device *device)
+{
+    if (libgtlm_reconnect_active(device->reconnect)) {
+        int result = libgtlm_resume_adopt(device);
+        if (result < 0)
+            return result;
+    }
+    if (!libgtlm_reconnect_replaying(device->reconnect))
+        return LIBUSB_SUCCESS;
+
+    int result = libgtlm_sync_confirmed(device);
+    if (result < 0)
+        return result;
+
+    libgtlm_reconnect_done(device->reconnect);
+    return LIBUSB_SUCCESS;
+}
+
+
+// Finds, opens and claims the controller into a zeroed device. Leaves the
+// config alone so it can be loaded concurrently.
+static int
+libgtlm_open(libgtlm_device *gtlm, bool forceReset)
+{
+    int owned = 0;
+    int fd = -1;
+    uint64_t openStart = GTLM_TRACE_BEGIN();
+    uint64_t trace = openStart;
+
+#ifdef GTLM_HAVE_SYSFS_OPEN
+    const libgtlm_device_id *id = NULL;
+    // Found through sysfs, so no device list is needed to open it. libusb
+    // still scans at init: LIBUSB_OPTION_NO_DEVICE_DISCOVERY would stick
+    // to the default context for good and break every later enumeration
+    // in this process (fallbacks, reconnects).
+    fd = libgtlm_sysfs_open(&id);
+    GTLM_TRACE_END("init", "sysfs_open", trace);
+#endif
+
+    trace = GTLM_TRACE_BEGIN();
     int result = libusb_init(NULL);
+    GTLM_TRACE_END("init", "libusb_init", trace);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return gtlm;
+        GTLM_REPORT_ERROR(result);
+#ifdef __linux__
+        if (fd >= 0)
+            close(fd);
+#endif
+        return result;
     }
 
-    gtlm = (libgtlm_device*)malloc(sizeof(*gtlm));
-    if (gtlm == NULL) goto error;
-    memset(gtlm, 0, sizeof(*gtlm));
+    gtlm->fd = fd;
+
+#ifdef GTLM_HAVE_SYSFS_OPEN
+    if (fd >= 0) {
+        result = libusb_wrap_sys_device(NULL, fd, &gtlm->handle);
+        if (result < 0) {
+            GTLM_REPORT_ERROR(result);
+            goto error;
+        }
+        gtlm->id = id;
+    }
+#endif
 
-    for (int i = 0; i < lmCount; i++) {
+    trace = GTLM_TRACE_BEGIN();
+    for (size_t i = 0; i < kLibgtlmDeviceIdCount && gtlm->handle == NULL; i++) {
         gtlm->handle = libusb_open_device_with_vid_pid(NULL,
                 libgtlm_device_ids[i].vendor, libgtlm_device_ids[i].product);
-        if (gtlm->handle)
+        if (gtlm->handle) {
+            gtlm->id = &libgtlm_device_ids[i];
             break;
+        }
     }
+    GTLM_TRACE_END("init", "open_device", trace);
 
     if (gtlm->handle == NULL) {
-        if (gDebug)
-            fprintf(stderr, "Led controller not found!\n");
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_INFO, "Led controller not found!");
+        result = LIBUSB_ERROR_NOT_FOUND;
         goto error;
     }
 
     if (forceReset) {
+        trace = GTLM_TRACE_BEGIN();
         result = libusb_reset_device(gtlm->handle);
+        GTLM_TRACE_END("init", "reset", trace);
         if (result < 0) {
-            print_libusb_error(result, __LINE__, __FILE__);
+            GTLM_REPORT_ERROR(result);
             goto error;
         }
     }
@@ -73,44 +259,148 @@ libgtlm_init(bool forceReset)
     if (owned == 1) {
         result = libusb_detach_kernel_driver(gtlm->handle, 0);
         if (result < 0) {
-            print_libusb_error(result, __LINE__, __FILE__);
+            GTLM_REPORT_ERROR(result);
             goto error;
         }
     }
 
-    if (gDebug) {
+    if (GTLM_LOG_ENABLED(SUBSYSTEM_CORE, LEVEL_DEBUG)) {
         char *string = libgtlm_get_device_name(gtlm);
-        fprintf(stderr, "Found LED controller: %s\n", string);
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_DEBUG, "Found LED controller: %s (fd %d)",
+            string ? string : "?", gtlm->fd);
         free(string);
     }
 
+    trace = GTLM_TRACE_BEGIN();
     result = libusb_claim_interface(gtlm->handle, 0x00);
+    GTLM_TRACE_END("init", "claim", trace);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
+        GTLM_REPORT_ERROR(result);
         goto error;
     }
 
+    trace = GTLM_TRACE_BEGIN();
+    result = libgtlm_pool_init(&gtlm->pool, gtlm->handle);
+    GTLM_TRACE_END("init", "pool_init", trace);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        goto error;
+    }
+    gtlm->transport = &gtlm->pool.transport;
+    gtlm->reconnect = libgtlm_reconnect_new(gtlm->id);
+
     libgtlm_get_led_mode(gtlm);
-    config_init(&gtlm->config);
-    return gtlm;
+    GTLM_TRACE_END("init", "open", openStart);
+    return LIBUSB_SUCCESS;
 
 error:
-    if (gtlm && gtlm->handle) {
+    if (gtlm->handle) {
+        libgtlm_pool_free(&gtlm->pool, gtlm->handle);
         libusb_release_interface(gtlm->handle, 0x00);
         libusb_close(gtlm->handle);
+        gtlm->handle = NULL;
     }
-    free(gtlm);
+#ifdef __linux__
+    if (fd >= 0)
+        close(fd);
+#endif
     libusb_exit(NULL);
-    return NULL;
+    return result;
+}
+
+
+libgtlm_device*
+libgtlm_init(bool forceReset)
+{
+    libgtlm_device *gtlm = (libgtlm_device*)malloc(sizeof(*gtlm));
+    if (gtlm == NULL)
+        return NULL;
+    memset(gtlm, 0, sizeof(*gtlm));
+    config_init(&gtlm->config);
+
+    if (libgtlm_open(gtlm, forceReset) < 0) {
+        config_destroy(&gtlm->config);
+        free(gtlm);
+        return NULL;
+    }
+    return gtlm;
+}
+
+
+libgtlm_device*
+libgtlm_init_with_config(bool forceReset)
+{
+    libgtlm_device *gtlm = (libgtlm_device*)malloc(sizeof(*gtlm));
+    if (gtlm == NULL)
+        return NULL;
+    memset(gtlm, 0, sizeof(*gtlm));
+    config_init(&gtlm->config);
+
+    // The loader only touches gtlm->config and the open never does, so the
+    // two share the device without locking until the join.
+    bool loaded = false;
+    std::thread loader([gtlm, &loaded] {
+        libgtlm_trace_thread_name("config loader");
+        loaded = libgtlm_load_config(&gtlm->config);
+    });
+    int result = libgtlm_open(gtlm, forceReset);
+    loader.join();
+
+    if (result < 0) {
+        config_destroy(&gtlm->config);
+        free(gtlm);
+        return NULL;
+    }
+    if (loaded)
+        libgtlm_apply_config(gtlm);
+    return gtlm;
+}
+
+
+libgtlm_device*
+libgtlm_open_transport(libgtlm_transport *transport)
+{
+    if (transport == NULL)
+        return NULL;
+
+    libgtlm_device *gtlm = (libgtlm_device*)malloc(sizeof(*gtlm));
+    if (gtlm == NULL)
+        return NULL;
+    memset(gtlm, 0, sizeof(*gtlm));
+    gtlm->fd = -1;
+
+    gtlm->id = &libgtlm_device_ids[0];
+    gtlm->transport = transport;
+    libgtlm_get_led_mode(gtlm);
+    config_init(&gtlm->config);
+    return gtlm;
 }
 
 
 void
 libgtlm_free(libgtlm_device *device)
 {
-    libusb_release_interface(device->handle, 0x00);
-    libusb_close(device->handle);
     config_destroy(&device->config);
+    if (device->transport != &device->pool.transport) {
+        free(device);
+        return;
+    }
+
+    libgtlm_reconnect_free(device->reconnect);
+    if (device->handle) {
+        libgtlm_pool_free(&device->pool, device->handle);
+        // a broker's descriptor was claimed for us; closing it releases
+        if (!device->borrowed)
+            libusb_release_interface(device->handle, 0x00);
+        libusb_close(device->handle);
+    }
+#ifdef __linux__
+    if (device->fd >= 0)
+        close(device->fd);
+    // the broker hands out the controller again once this closes
+    if (device->borrowed)
+        close(device->lease);
+#endif
     free(device);
     libusb_exit(NULL);
 }
@@ -121,7 +411,8 @@ libgtlm_check_version(libgtlm_device *device)
 {
     char version[6];
     memset(&version, 0x00, 6);
-    libgtlm_get_version(device, (char*)&version);
+    if (libgtlm_get_version(device, (char*)&version) < 0)
+        return false;
     if (strcmp((const char*)&version, GTLM_VERSION_STRING) == 0)
         return true;
 
@@ -129,39 +420,27 @@ libgtlm_check_version(libgtlm_device *device)
 }
 
 
-void
+int
 libgtlm_get_version(libgtlm_device *device, char *version)
 {
     if (device == NULL || version == NULL)
-        return;
+        return LIBUSB_ERROR_INVALID_PARAM;
 
-    int result = 0;
-    unsigned char data[8];
-    memset(&data, 0x00, 8);
-    data[0] = 0x01;
-    data[1] = 0x10;
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_OUT, LIBUSB_REQUEST_SET_CONFIGURATION,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
-    if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
-    }
+    int result = libgtlm_resume(device);
+    if (result < 0)
+        return result;
 
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_IN, LIBUSB_REQUEST_CLEAR_FEATURE,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    *device->transport->request = libgtlm_encode<CMD_GET_VERSION>();
+    result = libgtlm_transfer(device, CMD_GET_VERSION);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
+        GTLM_REPORT_ERROR(result);
+        return result;
     }
 
-    version[0] = data[2];
-    version[1] = data[3];
-    version[2] = data[4];
-    version[3] = data[5];
-    version[4] = data[6];
-    version[5] = '\0';
+    const libgtlm_packet *reply = device->transport->reply;
+    memcpy(version, &reply->data[GTLM_REPLY_VERSION], GTLM_REPLY_VERSION_SIZE);
+    version[GTLM_REPLY_VERSION_SIZE] = '\0';
+    return LIBUSB_SUCCESS;
 }
 
 
@@ -229,113 +508,366 @@ libgtlm_set_led_mode(libgtlm_device *device, libgtlm_led_mode mode, bool enable)
 }
 
 
-void
+int
 libgtlm_get_led_mode(libgtlm_device *device)
 {
     if (device == NULL)
-        return;
+        return LIBUSB_ERROR_INVALID_PARAM;
 
-    int result = 0;
-    unsigned char data[8];
-    memset(&data, 0x00, 8);
-    data[0] = 0x01;
-    data[1] = 0x01;
-    data[2] = 0x10;
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_OUT, LIBUSB_REQUEST_SET_CONFIGURATION,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    int result = libgtlm_resume(device);
+    if (result < 0)
+        return result;
+
+    *device->transport->request = libgtlm_encode<CMD_GET_LED_MODE>();
+    result = libgtlm_transfer(device, CMD_GET_LED_MODE);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
+        GTLM_REPORT_ERROR(result);
+        return result;
     }
 
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_IN, LIBUSB_REQUEST_CLEAR_FEATURE,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    const libgtlm_packet *reply = device->transport->reply;
+    device->led_mode = reply->data[GTLM_REPLY_LED_MODE];
+    device->enabled = reply->data[GTLM_REPLY_ENABLED] ? true : false;
+    return LIBUSB_SUCCESS;
+}
+
+
+// Sends both OUT packets and adopts whatever the controller reads back.
+static int
+libgtlm_sync_confirmed(libgtlm_device *device)
+{
+    libgtlm_packet *request = device->transport->request;
+    const libgtlm_packet *reply = device->transport->reply;
+
+    // led state part
+    *request = libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+    int result = libgtlm_transfer(device, CMD_SET_LED_STATUS);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
+        GTLM_REPORT_ERROR(result);
+        return result;
     }
 
-    device->led_mode = data[3];
-    device->enabled = data[4] ? true : false;
+    device->led_status = reply->data[GTLM_REPLY_LED_STATUS];
+
+    // led mode part
+    *request = libgtlm_encode<CMD_SET_LED_MODE>(device->led_mode,
+        device->enabled);
+    result = libgtlm_transfer(device, CMD_SET_LED_MODE);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        return result;
+    }
+
+    device->led_mode = reply->data[GTLM_REPLY_LED_MODE];
+    device->enabled = reply->data[GTLM_REPLY_ENABLED] ? true : false;
+    return LIBUSB_SUCCESS;
 }
 
 
-void
-libgtlm_sync(libgtlm_device *device)
+// Sends both OUT packets without reading anything back.
+static int
+libgtlm_sync_unconfirmed(libgtlm_device *device)
 {
-    if (device == NULL)
-        return;
+    libgtlm_packet *request = device->transport->request;
 
-    int result = 0;
-    unsigned char data[8];
+    *request = libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+    int result = libgtlm_send(device);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        return result;
+    }
 
-    // led state part
-    memset(&data, 0x00, 8);
-    data[0] = 0x01;
-    data[1] = 0x02;
-    data[2] = 0x30;
-    data[3] = device->led_status;
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_OUT, LIBUSB_REQUEST_SET_CONFIGURATION,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    *request = libgtlm_encode<CMD_SET_LED_MODE>(device->led_mode,
+        device->enabled);
+    result = libgtlm_send(device);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
+        GTLM_REPORT_ERROR(result);
+        return result;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+
+// Checks the controller against the desired state and corrects it. The mode
+// can be queried without side effects; the zone state has no such query, so
+// it is re-sent and the read-back compared with what was asked for.
+static int
+libgtlm_sync_verify(libgtlm_device *device)
+{
+    libgtlm_packet *request = device->transport->request;
+    const libgtlm_packet *reply = device->transport->reply;
+    bool drift = false;
+
+    *request = libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+    int result = libgtlm_transfer(device, CMD_SET_LED_STATUS);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        return result;
+    }
+
+    if (reply->data[GTLM_REPLY_LED_STATUS] != device->led_status) {
+        drift = true;
+        device->led_status = reply->data[GTLM_REPLY_LED_STATUS];
     }
 
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_IN, LIBUSB_REQUEST_CLEAR_FEATURE,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    *request = libgtlm_encode<CMD_GET_LED_MODE>();
+    result = libgtlm_transfer(device, CMD_GET_LED_MODE);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
-        return;
+        GTLM_REPORT_ERROR(result);
+        return result;
     }
 
-    device->led_status = data[3];
+    if (reply->data[GTLM_REPLY_LED_MODE] != device->led_mode
+        || (reply->data[GTLM_REPLY_ENABLED] != 0) != device->enabled) {
+        drift = true;
+        *request = libgtlm_encode<CMD_SET_LED_MODE>(device->led_mode,
+            device->enabled);
+        result = libgtlm_transfer(device, CMD_SET_LED_MODE);
+        if (result < 0) {
+            GTLM_REPORT_ERROR(result);
+            return result;
+        }
+
+        device->led_mode = reply->data[GTLM_REPLY_LED_MODE];
+        device->enabled = reply->data[GTLM_REPLY_ENABLED] ? true : false;
+    }
 
-    // led mode part
-    memset(&data, 0x00, 8);
-    data[0] = 0x01;
-    data[1] = 0x02;
-    data[2] = 0x20;
-    data[3] = device->led_mode;
-    data[4] = device->enabled;
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_OUT, LIBUSB_REQUEST_SET_CONFIGURATION,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
+    device->sync_stats.verifications++;
+    if (drift)
+        device->sync_stats.drifts++;
+    device->unverified_frames = 0;
+    device->last_verify = libgtlm_time_ns();
+    return LIBUSB_SUCCESS;
+}
+
+
+static bool
+libgtlm_verify_due(libgtlm_device *device)
+{
+    if (device->verify_frames != 0
+        && device->unverified_frames >= device->verify_frames)
+        return true;
+
+    if (device->verify_interval != 0 && libgtlm_time_ns() - device->last_verify
+            >= (uint64_t)device->verify_interval * 1000000)
+        return true;
+
+    return false;
+}
+
+
+int
+libgtlm_sync(libgtlm_device *device)
+{
+    if (device == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    int result = libgtlm_resume(device);
+    if (result < 0)
+        return result;
+
+    device->sync_stats.syncs++;
+    GTLM_LOG(SUBSYSTEM_CORE, LEVEL_TRACE, "sync zones %x mode %d enabled %d",
+        device->led_status, device->led_mode, device->enabled);
+    uint64_t trace = GTLM_TRACE_BEGIN();
+    bool readBack = true;
+    if (device->sync_mode == SYNC_CONFIRMED)
+        result = libgtlm_sync_confirmed(device);
+    else {
+        device->unverified_frames++;
+        if (libgtlm_verify_due(device))
+            result = libgtlm_sync_verify(device);
+        else {
+            result = libgtlm_sync_unconfirmed(device);
+            readBack = false;
+        }
+    }
+    GTLM_TRACE_END("core", "sync", trace);
+#ifdef __linux__
+    if (device->monitor)
+        libgtlm_monitor_publish(device->monitor, device);
+    // only what the device reported counts as confirmed
+    if (device->shm && readBack && result == LIBUSB_SUCCESS)
+        libgtlm_shm_publish(device->shm, device);
+#endif
+
+    return result;
+}
+
+
+// Pushes only the zone packet without reading it back, for callers that
+// toggle zones faster than a full sync allows.
+int
+libgtlm_send_led_status(libgtlm_device *device)
+{
+    if (device == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    int result = libgtlm_resume(device);
+    if (result < 0)
+        return result;
+
+    *device->transport->request =
+        libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+    result = libgtlm_send(device);
+#ifdef __linux__
+    if (device->monitor)
+        libgtlm_monitor_publish(device->monitor, device);
+#endif
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
+        GTLM_REPORT_ERROR(result);
+        return result;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+
+void
+libgtlm_set_sync_mode(libgtlm_device *device, libgtlm_sync_mode mode,
+    uint32_t verifyFrames, uint32_t verifyInterval)
+{
+    if (device == NULL)
         return;
+
+    device->sync_mode = mode;
+    device->verify_frames = verifyFrames;
+    device->verify_interval = verifyInterval;
+    device->unverified_frames = 0;
+    device->last_verify = libgtlm_time_ns();
+}
+
+
+void
+libgtlm_get_sync_stats(libgtlm_device *device, libgtlm_sync_stats *stats)
+{
+    if (device == NULL || stats == NULL)
+        return;
+
+    *stats = device->sync_stats;
+}
+
+
+void
+libgtlm_get_rtt(libgtlm_device *device, libgtlm_command command,
+    libgtlm_rtt *rtt)
+{
+    if (device == NULL || rtt == NULL || command >= CMD_COUNT)
+        return;
+
+    *rtt = device->rtt[command];
+}
+
+
+void
+libgtlm_get_latency(libgtlm_device *device, libgtlm_command command,
+    libgtlm_latency *latency)
+{
+    if (device == NULL || latency == NULL || command >= CMD_COUNT)
+        return;
+
+    *latency = device->latency[command];
+}
+
+
+void
+libgtlm_latency_add(libgtlm_latency *latency, uint64_t ns)
+{
+    if (latency == NULL)
+        return;
+
+    latency->buckets[libgtlm_latency_bucket(ns)]++;
+    latency->sum += ns;
+    latency->count++;
+}
+
+
+uint64_t
+libgtlm_latency_quantile(const libgtlm_latency *latency, double quantile)
+{
+    if (latency == NULL || latency->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(quantile * latency->count);
+    if (rank >= latency->count)
+        rank = latency->count - 1;
+
+    uint64_t seen = 0;
+    int bucket = 0;
+    for (; bucket < GTLM_LATENCY_BUCKETS - 1; bucket++) {
+        seen += latency->buckets[bucket];
+        if (seen > rank)
+            break;
     }
 
-    result = libusb_control_transfer(device->handle,
-        GTLM_CONFIG_REQUEST_TYPE_IN, LIBUSB_REQUEST_CLEAR_FEATURE,
-        GTLM_CONFIG_VALUE, GTLM_CONFIG_INDEX, (unsigned char*)&data, 8, 0x00);
-    if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
+    // middle of the bucket
+    if (bucket < 4)
+        return bucket * 1000 + 500;
+    int octave = bucket / 4 + 1;
+    uint64_t width = 1ULL << (octave - 2);
+    uint64_t lower = (uint64_t)(4 + bucket % 4) << (octave - 2);
+    return (lower * 1000) + width * 500;
+}
+
+
+void
+libgtlm_set_auto_reconnect(libgtlm_device *device, bool enable)
+{
+    if (device == NULL || device->transport != &device->pool.transport)
         return;
+
+    if (enable && device->reconnect == NULL)
+        device->reconnect = libgtlm_reconnect_new(device->id);
+    else if (!enable) {
+        libgtlm_reconnect_free(device->reconnect);
+        device->reconnect = NULL;
     }
+}
+
+
+void
+libgtlm_get_reconnect_stats(libgtlm_device *device,
+    libgtlm_reconnect_stats *stats)
+{
+    if (device == NULL || stats == NULL)
+        return;
+
+    if (device->reconnect == NULL)
+        *stats = libgtlm_reconnect_stats();
+    else
+        libgtlm_reconnect_get_stats(device->reconnect, stats);
+}
+
 
-    device->led_mode = data[3];
-    device->enabled = data[4] ? true : false;
+uint64_t
+libgtlm_time_ns()
+{
+    if (gClock)
+        return gClock(gClockData);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 
 void
-libgtlm_set_debug(bool debug)
+libgtlm_set_clock(uint64_t (*clock)(void *data), void *data)
 {
-    gDebug = debug;
+    gClockData = data;
+    gClock = clock;
 }
 
 
-bool
-libgtlm_read_config(libgtlm_device *device)
+void
+libgtlm_set_debug(bool debug)
 {
-    if (device == NULL)
-        return false;
+    libgtlm_set_log_level(SUBSYSTEM_COUNT, debug ? LEVEL_DEBUG : LEVEL_WARN);
+}
+
 
+static bool
+libgtlm_load_config(config_t *config)
+{
     char *home = getenv("HOME");
     char *cfg = NULL;
     int result = 0;
@@ -345,14 +877,22 @@ libgtlm_read_config(libgtlm_device *device)
         if (cfg == NULL)
             return false;
         snprintf(cfg, len, "%s%s", home, gCfgName);
-        result = config_read_file(&device->config, cfg);
+        uint64_t trace = GTLM_TRACE_BEGIN();
+        result = config_read_file(config, cfg);
+        GTLM_TRACE_END("config", "read", trace);
         if (result < 0) {
             free(cfg);
             return false;
         }
         free(cfg);
     }
+    return true;
+}
+
 
+static void
+libgtlm_apply_config(libgtlm_device *device)
+{
     bool back = true;
     bool side = true;
     bool front = true;
@@ -391,6 +931,18 @@ libgtlm_read_config(libgtlm_device *device)
     else
         libgtlm_disable_led(device, LEDS_FRONT);
     libgtlm_set_led_mode(device, (libgtlm_led_mode)mode, enabled);
+}
+
+
+bool
+libgtlm_read_config(libgtlm_device *device)
+{
+    if (device == NULL)
+        return false;
+
+    if (!libgtlm_load_config(&device->config))
+        return false;
+    libgtlm_apply_config(device);
     return true;
 }
 
@@ -441,7 +993,9 @@ libgtlm_write_config(libgtlm_device *device)
         if (cfg == NULL)
             return false;
         snprintf(cfg, len, "%s%s", home, gCfgName);
+        uint64_t trace = GTLM_TRACE_BEGIN();
         result = config_write_file(&device->config, cfg);
+        GTLM_TRACE_END("config", "write", trace);
         if (result < 0) {
             free(cfg);
             return false;
@@ -449,6 +1003,9 @@ libgtlm_write_config(libgtlm_device *device)
         free(cfg);
     }
 
+#ifdef __linux__
+    libgtlm_save_state(device);
+#endif
     return true;
 }
 
@@ -459,20 +1016,23 @@ libgtlm_get_device_name(libgtlm_device *device)
     if (device == NULL)
         return NULL;
 
+    if (device->handle == NULL)
+        return strdup(device->id->name);
+
     char *string = (char*)malloc(128);
     libusb_device *dev;
     libusb_device_descriptor descriptor;
     dev = libusb_get_device(device->handle);
     int result = libusb_get_device_descriptor(dev, &descriptor);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
+        GTLM_REPORT_ERROR(result);
         free(string);
         return NULL;
     }
     result = libusb_get_string_descriptor_ascii(device->handle,
         descriptor.iManufacturer, (unsigned char*)string, 128);
     if (result < 0) {
-        print_libusb_error(result, __LINE__, __FILE__);
+        GTLM_REPORT_ERROR(result);
         free(string);
         return NULL;
     }
@@ -480,50 +1040,3 @@ libgtlm_get_device_name(libgtlm_device *device)
     return string;
 }
 
-
-void print_libusb_error(int error, int line, const char *file)
-{
-    fprintf(stderr, "ERROR: %s:%d:", file, line);
-    switch (error) {
-    case LIBUSB_ERROR_IO:
-        fprintf(stderr, "IO\n");
-        break;
-    case LIBUSB_ERROR_INVALID_PARAM:
-        fprintf(stderr, "INVALID PARAM\n");
-        break;
-    case LIBUSB_ERROR_ACCESS:
-        fprintf(stderr, "ACCESS\n");
-        break;
-    case LIBUSB_ERROR_NOT_FOUND:
-        fprintf(stderr, "NOT FOUND\n");
-        break;
-    case LIBUSB_ERROR_BUSY:
-        fprintf(stderr, "BUSY\n");
-        break;
-    case LIBUSB_ERROR_OVERFLOW:
-        fprintf(stderr, "OVERFLOW\n");
-        break;
-    case LIBUSB_ERROR_INTERRUPTED:
-        fprintf(stderr, "INTERRUPTED\n");
-        break;
-    case LIBUSB_ERROR_NO_MEM:
-        fprintf(stderr, "NO MEMORY\n");
-        break;
-    case LIBUSB_ERROR_NOT_SUPPORTED:
-        fprintf(stderr, "NOT SUPPORTED\n");
-        break;
-    case LIBUSB_ERROR_TIMEOUT:
-        fprintf(stderr, "TIMEOUT\n");
-        break;
-    case LIBUSB_ERROR_PIPE:
-        fprintf(stderr, "PIPE\n");
-        break;
-    case LIBUSB_ERROR_NO_DEVICE:
-        fprintf(stderr, "NO DEVICE\n");
-        break;
-    case LIBUSB_ERROR_OTHER:
-    default:
-        fprintf(stderr, "%d\n", error);
-        break;
-    }
-}
@@ -24,10 +24,20 @@
 #ifndef __LIBGTLM_H__
 #define __LIBGTLM_H__
 
+// release builds define NDEBUG
+#ifndef NDEBUG
+#define DEBUG_LIBGTLM
+#endif
+
 #include "libconfig.h"
 #include "libusb.h"
-
-#define DEBUG_LIBGTLM
+#include "libgtlm_protocol.h"
+#include "libgtlm_transport.h"
+#include "libgtlm_pool.h"
+#include "libgtlm_error.h"
+#include "libgtlm_log.h"
+#include "libgtlm_trace.h"
+#include "libgtlm_reconnect.h"
 
 #define GTLM_CONFIG_REQUEST_TYPE_IN  (LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE)
 #define GTLM_CONFIG_REQUEST_TYPE_OUT (LIBUSB_ENDPOINT_OUT |LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE)
@@ -45,6 +55,8 @@ enum libgtlm_led_status {
     LEDS_ALL        = 0x07
 };
 
+#define GTLM_ZONE_COUNT              3
+
 enum libgtlm_led_mode {
     MODE_BLINK      = 0x01,
     MODE_AUDIO      = 0x02,
@@ -53,36 +65,124 @@ enum libgtlm_led_mode {
     MODE_ALWAYS     = 0x05
 };
 
-typedef struct libgtlm_device_id {
-    uint16_t vendor;
-    uint16_t product;
-} libgtlm_device_id;
+// Desired controller state, as handed between producers and the device.
+typedef struct libgtlm_frame {
+    uint8_t led_status;
+    uint8_t led_mode;
+    bool enabled;
+} libgtlm_frame;
+
+// What the controller comes up with after power-on or a bus reset.
+#define GTLM_POWER_ON_STATUS         LEDS_ALL
+#define GTLM_POWER_ON_MODE           MODE_ALWAYS
+#define GTLM_POWER_ON_ENABLED        true
 
-static libgtlm_device_id libgtlm_device_ids[] = {
-    { 0x1770, 0xFF00 }, // MSI GT660 LED Controller - MSI EPF USB
+// SYNC_CONFIRMED reads every OUT packet back and adopts the reply.
+// SYNC_FIRE_AND_FORGET sends only the OUT packets and verifies the device
+// state every verify_frames syncs or verify_interval milliseconds,
+// whichever comes first (0 disables either trigger).
+enum libgtlm_sync_mode {
+    SYNC_CONFIRMED          = 0,
+    SYNC_FIRE_AND_FORGET    = 1
 };
 
+typedef struct libgtlm_sync_stats {
+    uint64_t syncs;
+    uint64_t verifications;
+    uint64_t drifts;            // verifications that found the device off
+    uint64_t skipped;           // syncs left out because nothing changed
+} libgtlm_sync_stats;
+
+// Round-trip time of OUT/IN pairs for one command, in nanoseconds.
+typedef struct libgtlm_rtt {
+    uint64_t srtt;
+    uint64_t rttvar;
+    uint64_t samples;
+} libgtlm_rtt;
+
+#define GTLM_LATENCY_BUCKETS         64
+
+// Round-trip histogram for one command: four buckets per power of two
+// microseconds up to about 130 ms, so a quantile read from it is off by at
+// most an eighth of its value.
+typedef struct libgtlm_latency {
+    uint32_t buckets[GTLM_LATENCY_BUCKETS];
+    uint64_t sum;               // ns
+    uint64_t count;
+} libgtlm_latency;
+
+struct libgtlm_monitor;
+struct libgtlm_shm;
+
 typedef struct libgtlm_device {
     libusb_device_handle* handle;
+    int fd;                     // usbfs descriptor libusb wraps, or -1
+    bool borrowed;              // fd and claim were leased from a broker
+    int lease;                  // broker connection, while borrowed
+    const libgtlm_device_id *id;
     uint8_t led_status;
     uint8_t led_mode;
     bool enabled;
     config_t config;
+    libgtlm_transfer_pool pool;
+    libgtlm_transport *transport;
+    libgtlm_sync_mode sync_mode;
+    uint32_t verify_frames;
+    uint32_t verify_interval;
+    uint32_t unverified_frames;
+    uint64_t last_verify;
+    libgtlm_sync_stats sync_stats;
+    libgtlm_rtt rtt[CMD_COUNT];
+    libgtlm_latency latency[CMD_COUNT];
+    libgtlm_reconnect *reconnect;
+    struct libgtlm_monitor *monitor;    // libgtlm_monitor.h, Linux only
+    struct libgtlm_shm *shm;            // libgtlm_shm.h, Linux only
 } libgtlm_device;
 
 
+// Functions returning int give LIBUSB_SUCCESS or a negative libusb_error
+// code; failures are also recorded in the error ring (libgtlm_error.h).
 libgtlm_device* libgtlm_init(bool forceReset);
+// Same as libgtlm_init followed by libgtlm_read_config, but parses the
+// config on a second thread while the controller is found and claimed.
+libgtlm_device* libgtlm_init_with_config(bool forceReset);
+// Drives a controller through a caller-owned transport instead of libusb,
+// e.g. a simulator; the transport must outlive the device.
+libgtlm_device* libgtlm_open_transport(libgtlm_transport *transport);
 void libgtlm_free(libgtlm_device *device);
 bool libgtlm_check_version(libgtlm_device *device);
-void libgtlm_get_version(libgtlm_device *device, char *version);
+int libgtlm_get_version(libgtlm_device *device, char *version);
 void libgtlm_enable_led(libgtlm_device *device, libgtlm_led_status status);
 void libgtlm_disable_led(libgtlm_device *device, libgtlm_led_status status);
 void libgtlm_enable_all_leds(libgtlm_device *device);
 void libgtlm_disable_all_leds(libgtlm_device *device);
 bool libgtlm_is_led_enabled(libgtlm_device *device, libgtlm_led_status status);
 void libgtlm_set_led_mode(libgtlm_device *device, libgtlm_led_mode mode, bool enable);
-void libgtlm_get_led_mode(libgtlm_device *device);
-void libgtlm_sync(libgtlm_device *device);
+int libgtlm_get_led_mode(libgtlm_device *device);
+int libgtlm_sync(libgtlm_device *device);
+int libgtlm_send_led_status(libgtlm_device *device);
+void libgtlm_set_sync_mode(libgtlm_device *device, libgtlm_sync_mode mode,
+    uint32_t verifyFrames, uint32_t verifyInterval);
+void libgtlm_get_sync_stats(libgtlm_device *device, libgtlm_sync_stats *stats);
+void libgtlm_get_rtt(libgtlm_device *device, libgtlm_command command,
+    libgtlm_rtt *rtt);
+void libgtlm_get_latency(libgtlm_device *device, libgtlm_command command,
+    libgtlm_latency *latency);
+void libgtlm_latency_add(libgtlm_latency *latency, uint64_t ns);
+// Estimate in ns, e.g. quantile 0.99; 0 without samples.
+uint64_t libgtlm_latency_quantile(const libgtlm_latency *latency,
+    double quantile);
+// A libusb device that starts failing with LIBUSB_ERROR_NO_DEVICE (reset,
+// re-enumeration, replug) is re-opened and re-claimed in the background.
+// Until then calls fail fast with LIBUSB_ERROR_NO_DEVICE; the first call
+// after it is back replays the desired zone and mode state. On by default.
+void libgtlm_set_auto_reconnect(libgtlm_device *device, bool enable);
+void libgtlm_get_reconnect_stats(libgtlm_device *device,
+    libgtlm_reconnect_stats *stats);
+uint64_t libgtlm_time_ns();
+// Replaces the steady clock behind libgtlm_time_ns(), e.g. with a virtual
+// clock; NULL restores it. Set it before any device threads are started.
+void libgtlm_set_clock(uint64_t (*clock)(void *data), void *data);
 void libgtlm_set_debug(bool debug);
 bool libgtlm_read_config(libgtlm_device *device);
 bool libgtlm_write_config(libgtlm_device *device);
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/usbdevice_fs.h>
+#include "libgtlm_broker.h"
+#include "libgtlm_sysfs.h"
+
+// Sent along with the descriptor.
+typedef struct libgtlm_broker_hello {
+    uint16_t vendor;
+    uint16_t product;
+} libgtlm_broker_hello;
+
+struct libgtlm_broker {
+    int listen_fd;
+    int lease_fd;               // connection of the client holding the claim
+    char *path;
+    const libgtlm_device_id *id;
+};
+
+
+// The previous client's descriptor may close a moment after its
+// connection, e.g. when it exits without freeing the device.
+static int
+libgtlm_broker_claim(int fd)
+{
+    int result = libgtlm_sysfs_claim(fd);
+    for (int i = 0; i < GTLM_BROKER_CLAIM_RETRIES
+            && result == LIBUSB_ERROR_BUSY; i++) {
+        usleep(GTLM_BROKER_CLAIM_DELAY);
+        result = libgtlm_sysfs_claim(fd);
+    }
+
+    if (result < 0) {
+        close(fd);
+        return result;
+    }
+    return fd;
+}
+
+
+// Opens a new usbfs descriptor on the controller, detaches the kernel
+// driver and claims the interface on it. sysfs is tried first as it needs
+// no enumeration. Returns the descriptor or a libusb_error code.
+static int
+libgtlm_broker_open_usb(libgtlm_broker *broker)
+{
+    int fd = libgtlm_sysfs_open(&broker->id);
+    if (fd >= 0)
+        return libgtlm_broker_claim(fd);
+
+    libusb_device_handle *handle = NULL;
+    for (size_t i = 0; i < kLibgtlmDeviceIdCount && handle == NULL; i++) {
+        handle = libusb_open_device_with_vid_pid(NULL,
+            libgtlm_device_ids[i].vendor, libgtlm_device_ids[i].product);
+        if (handle)
+            broker->id = &libgtlm_device_ids[i];
+    }
+    if (handle == NULL)
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    int result = 0;
+    if (libusb_kernel_driver_active(handle, 0) == 1)
+        result = libusb_detach_kernel_driver(handle, 0);
+
+    char path[32];
+    libusb_device *device = libusb_get_device(handle);
+    snprintf(path, sizeof(path), "/dev/bus/usb/%03u/%03u",
+        libusb_get_bus_number(device), libusb_get_device_address(device));
+    libusb_close(handle);
+    if (result < 0)
+        return result;
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return libgtlm_sysfs_error(errno);
+
+    return libgtlm_broker_claim(fd);
+}
+
+
+libgtlm_broker*
+libgtlm_broker_new(const char *path, int mode)
+{
+    if (path == NULL)
+        path = GTLM_BROKER_PATH;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return NULL;
+    strcpy(address.sun_path, path);
+
+    int result = libusb_init(NULL);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        return NULL;
+    }
+
+    libgtlm_broker *broker = new libgtlm_broker;
+    broker->listen_fd = -1;
+    broker->lease_fd = -1;
+    broker->path = NULL;
+    broker->id = NULL;
+
+    // make sure there is a controller to hand out; one that is claimed
+    // already is busy, not missing
+    result = libgtlm_broker_open_usb(broker);
+    if (result < 0 && result != LIBUSB_ERROR_BUSY) {
+        GTLM_REPORT_ERROR(result);
+        goto error;
+    }
+    if (result >= 0)
+        close(result);
+
+    broker->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (broker->listen_fd < 0)
+        goto error;
+
+    // a socket left behind by a previous broker
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    if (bind(broker->listen_fd, (struct sockaddr*)&address,
+            sizeof(address)) < 0)
+        goto error;
+    broker->path = strdup(path);
+    // the umask applies to bind; clients may run as other users
+    if (chmod(path, mode) < 0 || listen(broker->listen_fd, 16) < 0)
+        goto error;
+
+    return broker;
+
+error:
+    libgtlm_broker_free(broker);
+    return NULL;
+}
+
+
+libgtlm_broker*
+libgtlm_broker_activate()
+{
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+    if (pid == NULL || fds == NULL || strtol(pid, NULL, 10) != getpid()
+        || strtol(fds, NULL, 10) < 1)
+        return NULL;
+    // meant for this process only, not for anything it starts
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    int fd = GTLM_LISTEN_FDS_START;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISSOCK(info.st_mode))
+        return NULL;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    int result = libusb_init(NULL);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        return NULL;
+    }
+
+    // The controller is opened by the first serve; the client that caused
+    // the activation is already waiting in the backlog. No path, so the
+    // socket systemd owns is left in place on free.
+    libgtlm_broker *broker = new libgtlm_broker;
+    broker->listen_fd = fd;
+    broker->lease_fd = -1;
+    broker->path = NULL;
+    broker->id = NULL;
+    return broker;
+}
+
+
+void
+libgtlm_broker_free(libgtlm_broker *broker)
+{
+    if (broker == NULL)
+        return;
+
+    if (broker->listen_fd >= 0)
+        close(broker->listen_fd);
+    if (broker->path) {
+        unlink(broker->path);
+        free(broker->path);
+    }
+    // the client keeps its descriptor and claim
+    if (broker->lease_fd >= 0)
+        close(broker->lease_fd);
+    delete broker;
+    libusb_exit(NULL);
+}
+
+
+int
+libgtlm_broker_get_fd(libgtlm_broker *broker)
+{
+    return broker ? broker->listen_fd : -1;
+}
+
+
+int
+libgtlm_broker_serve(libgtlm_broker *broker)
+{
+    if (broker == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+    if (broker->lease_fd >= 0)
+        return LIBUSB_ERROR_BUSY;
+
+    int client = accept4(broker->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0)
+        return libgtlm_sysfs_error(errno);
+
+    // A fresh open file per client: usbfs keeps one completion list per
+    // open file, so clients sharing one would reap each other's URBs.
+    int fd = libgtlm_broker_open_usb(broker);
+    int result = fd < 0 ? fd : LIBUSB_SUCCESS;
+    if (result < 0)
+        GTLM_REPORT_ERROR(result);
+
+    // a client that gets no descriptor sees the connection close
+    if (result == LIBUSB_SUCCESS) {
+        libgtlm_broker_hello hello = { broker->id->vendor,
+            broker->id->product };
+        struct iovec data = { &hello, sizeof(hello) };
+        union {
+            struct cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+        // a client that timed out waiting has hung up already
+        if (sendmsg(client, &message, MSG_NOSIGNAL) < 0) {
+            result = libgtlm_sysfs_error(errno);
+            GTLM_LOG(SUBSYSTEM_BROKER, LEVEL_DEBUG, "client left: %s",
+                strerror(errno));
+        }
+        // the client's copy now holds the claim on its own
+        close(fd);
+    }
+
+    if (result < 0) {
+        close(client);
+        return result;
+    }
+
+    GTLM_LOG(SUBSYSTEM_BROKER, LEVEL_DEBUG, "leased the controller on fd %d",
+        client);
+    broker->lease_fd = client;
+    return LIBUSB_SUCCESS;
+}
+
+
+int
+libgtlm_broker_get_lease_fd(libgtlm_broker *broker)
+{
+    return broker ? broker->lease_fd : -1;
+}
+
+
+void
+libgtlm_broker_release(libgtlm_broker *broker)
+{
+    if (broker == NULL || broker->lease_fd < 0)
+        return;
+
+    GTLM_LOG(SUBSYSTEM_BROKER, LEVEL_DEBUG, "lease on fd %d ended",
+        broker->lease_fd);
+    close(broker->lease_fd);
+    broker->lease_fd = -1;
+}
+
+
+#ifdef GTLM_HAVE_WRAP_SYS_DEVICE
+// Receives the descriptor and the controller ids from the broker. The
+// connection is handed back in lease and must stay open while the
+// descriptor is in use.
+static int
+libgtlm_broker_receive(const char *path, libgtlm_broker_hello *hello,
+    int *lease)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    // another client may hold the lease; wait for it only so long
+    struct timeval timeout = { GTLM_BROKER_TIMEOUT / 1000,
+        (GTLM_BROKER_TIMEOUT % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct iovec data = { hello, sizeof(*hello) };
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t size = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *header = size < 0 ? NULL : CMSG_FIRSTHDR(&message);
+    if (header == NULL || header->cmsg_level != SOL_SOCKET
+        || header->cmsg_type != SCM_RIGHTS) {
+        close(sock);
+        return -1;
+    }
+
+    int fd = -1;
+    memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    if (size != (ssize_t)sizeof(*hello)) {
+        close(fd);
+        close(sock);
+        return -1;
+    }
+    *lease = sock;
+    return fd;
+}
+#endif
+
+
+libgtlm_device*
+libgtlm_connect(const char *path)
+{
+#ifdef GTLM_HAVE_WRAP_SYS_DEVICE
+    if (path == NULL)
+        path = GTLM_BROKER_PATH;
+
+    libgtlm_broker_hello hello;
+    int lease = -1;
+    int fd = libgtlm_broker_receive(path, &hello, &lease);
+    if (fd < 0)
+        return NULL;
+
+    int result = libusb_init(NULL);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        close(fd);
+        close(lease);
+        return NULL;
+    }
+
+    libgtlm_device *gtlm = (libgtlm_device*)malloc(sizeof(*gtlm));
+    if (gtlm == NULL)
+        goto error;
+    memset(gtlm, 0, sizeof(*gtlm));
+    gtlm->fd = fd;
+    gtlm->lease = lease;
+    gtlm->borrowed = true;
+    gtlm->id = libgtlm_find_device_id(hello.vendor, hello.product);
+    if (gtlm->id == NULL)
+        gtlm->id = &libgtlm_device_ids[0];
+
+    result = libusb_wrap_sys_device(NULL, fd, &gtlm->handle);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        goto error;
+    }
+
+    result = libgtlm_pool_init(&gtlm->pool, gtlm->handle);
+    if (result < 0) {
+        GTLM_REPORT_ERROR(result);
+        goto error;
+    }
+    gtlm->transport = &gtlm->pool.transport;
+
+    libgtlm_get_led_mode(gtlm);
+    config_init(&gtlm->config);
+    return gtlm;
+
+error:
+    if (gtlm && gtlm->handle)
+        libusb_close(gtlm->handle);
+    free(gtlm);
+    close(fd);
+    close(lease);
+    libusb_exit(NULL);
+    return NULL;
+#else
+    (void)path;
+    GTLM_REPORT_ERROR(LIBUSB_ERROR_NOT_SUPPORTED);
+    return NULL;
+#endif
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_BROKER_H__
+#define __LIBGTLM_BROKER_H__
+
+#include "libgtlm.h"
+
+#define GTLM_BROKER_PATH             "/run/gtlm.sock"
+// first descriptor passed by systemd socket activation
+#define GTLM_LISTEN_FDS_START        3
+// ms a client waits for the controller while another one holds it
+#define GTLM_BROKER_TIMEOUT          2000
+// claim attempts while the previous client's descriptor closes
+#define GTLM_BROKER_CLAIM_RETRIES    20
+#define GTLM_BROKER_CLAIM_DELAY      5000           // us
+
+typedef struct libgtlm_broker libgtlm_broker;
+
+// Hands the controller to unprivileged processes (Linux only), one at a
+// time. For each client the broker opens the usbfs node anew, detaches the
+// kernel driver, claims the interface on that descriptor and passes it
+// over its socket with SCM_RIGHTS, so the client neither enumerates nor
+// claims anything. Descriptors are never shared: usbfs completions are per
+// open file, and two processes on one would reap each other's transfers.
+//
+// The client's connection stays open as its lease. Until it closes, which
+// libgtlm_free() does after closing the descriptor, the broker accepts no
+// one else; waiting clients give up after GTLM_BROKER_TIMEOUT.
+libgtlm_broker* libgtlm_broker_new(const char *path, int mode);
+// Same, on a listening socket inherited through systemd socket activation
+// (LISTEN_PID/LISTEN_FDS). NULL when the process was not activated.
+libgtlm_broker* libgtlm_broker_activate();
+void libgtlm_broker_free(libgtlm_broker *broker);
+// Listening socket, e.g. for libgtlm_loop_add_fd().
+int libgtlm_broker_get_fd(libgtlm_broker *broker);
+// Accepts one client and leases it a descriptor; blocks until one connects
+// unless the socket is readable. LIBUSB_ERROR_BUSY while a lease is held.
+int libgtlm_broker_serve(libgtlm_broker *broker);
+// Connection of the leasing client, or -1. It turns readable when the
+// client hangs up; call libgtlm_broker_release() then.
+int libgtlm_broker_get_lease_fd(libgtlm_broker *broker);
+void libgtlm_broker_release(libgtlm_broker *broker);
+
+// Client side: a device on a descriptor leased from the broker, or NULL
+// when no broker answers in time or libusb lacks libusb_wrap_sys_device().
+// Needs no privileges.
+// Such a device is not reconnected automatically; connect again instead.
+libgtlm_device* libgtlm_connect(const char *path);
+
+#endif // __LIBGTLM_BROKER_H__
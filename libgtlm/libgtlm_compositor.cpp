@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <string.h>
+#include "libgtlm_compositor.h"
+
+
+typedef struct libgtlm_layer {
+    bool used;
+    int priority;
+    uint8_t zones;
+    uint8_t status;
+    bool has_mode;
+    uint8_t mode;
+    bool enabled;
+    uint64_t expires;
+} libgtlm_layer;
+
+struct libgtlm_compositor {
+    libgtlm_device *device;
+    libgtlm_layer layers[GTLM_MAX_LAYERS];
+    int order[GTLM_MAX_LAYERS];     // used layers, highest priority first
+    int count;
+    libgtlm_frame base;
+    libgtlm_frame current;
+    uint8_t dirty_zones;
+    bool dirty_mode;
+};
+
+
+static libgtlm_layer*
+libgtlm_compositor_layer(libgtlm_compositor *compositor, int layer)
+{
+    if (compositor == NULL || layer < 0 || layer >= GTLM_MAX_LAYERS
+        || !compositor->layers[layer].used)
+        return NULL;
+
+    return &compositor->layers[layer];
+}
+
+
+static void
+libgtlm_compositor_touch(libgtlm_compositor *compositor, libgtlm_layer *layer)
+{
+    compositor->dirty_zones |= layer->zones;
+    if (layer->has_mode)
+        compositor->dirty_mode = true;
+}
+
+
+static void
+libgtlm_layer_set_lifetime(libgtlm_layer *layer, uint32_t lifetime)
+{
+    layer->expires = lifetime ? libgtlm_time_ns()
+        + (uint64_t)lifetime * 1000000 : 0;
+}
+
+
+libgtlm_compositor*
+libgtlm_compositor_new(libgtlm_device *device)
+{
+    if (device == NULL)
+        return NULL;
+
+    libgtlm_compositor *compositor =
+        (libgtlm_compositor*)malloc(sizeof(*compositor));
+    if (compositor == NULL)
+        return NULL;
+
+    memset(compositor, 0, sizeof(*compositor));
+    compositor->device = device;
+    compositor->base.led_status = device->led_status;
+    compositor->base.led_mode = device->led_mode;
+    compositor->base.enabled = device->enabled;
+    compositor->current = compositor->base;
+    return compositor;
+}
+
+
+void
+libgtlm_compositor_free(libgtlm_compositor *compositor)
+{
+    free(compositor);
+}
+
+
+// Layers of equal priority stack in creation order, newest on top.
+int
+libgtlm_compositor_add_layer(libgtlm_compositor *compositor, int priority)
+{
+    if (compositor == NULL || compositor->count == GTLM_MAX_LAYERS)
+        return -1;
+
+    int layer = 0;
+    while (compositor->layers[layer].used)
+        layer++;
+    memset(&compositor->layers[layer], 0, sizeof(libgtlm_layer));
+    compositor->layers[layer].used = true;
+    compositor->layers[layer].priority = priority;
+
+    int position = 0;
+    while (position < compositor->count
+        && compositor->layers[compositor->order[position]].priority > priority)
+        position++;
+    memmove(&compositor->order[position + 1], &compositor->order[position],
+        (compositor->count - position) * sizeof(int));
+    compositor->order[position] = layer;
+    compositor->count++;
+    return layer;
+}
+
+
+void
+libgtlm_compositor_remove_layer(libgtlm_compositor *compositor, int layer)
+{
+    libgtlm_layer *entry = libgtlm_compositor_layer(compositor, layer);
+    if (entry == NULL)
+        return;
+
+    libgtlm_compositor_touch(compositor, entry);
+    entry->used = false;
+
+    int position = 0;
+    while (compositor->order[position] != layer)
+        position++;
+    memmove(&compositor->order[position], &compositor->order[position + 1],
+        (compositor->count - position - 1) * sizeof(int));
+    compositor->count--;
+}
+
+
+void
+libgtlm_compositor_set_zones(libgtlm_compositor *compositor, int layer,
+    uint8_t zones, uint8_t status, uint32_t lifetime)
+{
+    libgtlm_layer *entry = libgtlm_compositor_layer(compositor, layer);
+    if (entry == NULL)
+        return;
+
+    zones &= LEDS_ALL;
+    compositor->dirty_zones |= entry->zones | zones;
+    entry->zones = zones;
+    entry->status = status & zones;
+    libgtlm_layer_set_lifetime(entry, lifetime);
+}
+
+
+void
+libgtlm_compositor_set_mode(libgtlm_compositor *compositor, int layer,
+    libgtlm_led_mode mode, bool enable, uint32_t lifetime)
+{
+    libgtlm_layer *entry = libgtlm_compositor_layer(compositor, layer);
+    if (entry == NULL)
+        return;
+
+    compositor->dirty_mode = true;
+    entry->has_mode = true;
+    entry->mode = mode;
+    entry->enabled = enable;
+    libgtlm_layer_set_lifetime(entry, lifetime);
+}
+
+
+void
+libgtlm_compositor_clear(libgtlm_compositor *compositor, int layer)
+{
+    libgtlm_layer *entry = libgtlm_compositor_layer(compositor, layer);
+    if (entry == NULL)
+        return;
+
+    libgtlm_compositor_touch(compositor, entry);
+    entry->zones = 0;
+    entry->status = 0;
+    entry->has_mode = false;
+    entry->expires = 0;
+}
+
+
+bool
+libgtlm_compositor_flatten(libgtlm_compositor *compositor,
+    libgtlm_frame *frame)
+{
+    if (compositor == NULL)
+        return false;
+
+    uint64_t now = libgtlm_time_ns();
+    for (int i = 0; i < compositor->count; i++) {
+        int layer = compositor->order[i];
+        if (compositor->layers[layer].expires != 0
+            && compositor->layers[layer].expires <= now)
+            libgtlm_compositor_clear(compositor, layer);
+    }
+
+    libgtlm_frame result = compositor->current;
+    for (int zone = 0; zone < GTLM_ZONE_COUNT; zone++) {
+        uint8_t bit = 1 << zone;
+        if ((compositor->dirty_zones & bit) == 0)
+            continue;
+
+        uint8_t value = compositor->base.led_status & bit;
+        for (int i = 0; i < compositor->count; i++) {
+            const libgtlm_layer *entry =
+                &compositor->layers[compositor->order[i]];
+            if (entry->zones & bit) {
+                value = entry->status & bit;
+                break;
+            }
+        }
+        result.led_status = (result.led_status & ~bit) | value;
+    }
+
+    if (compositor->dirty_mode) {
+        result.led_mode = compositor->base.led_mode;
+        result.enabled = compositor->base.enabled;
+        for (int i = 0; i < compositor->count; i++) {
+            const libgtlm_layer *entry =
+                &compositor->layers[compositor->order[i]];
+            if (entry->has_mode) {
+                result.led_mode = entry->mode;
+                result.enabled = entry->enabled;
+                break;
+            }
+        }
+    }
+
+    compositor->dirty_zones = 0;
+    compositor->dirty_mode = false;
+    if (memcmp(&result, &compositor->current, sizeof(result)) == 0)
+        return false;
+
+    compositor->current = result;
+    if (frame)
+        *frame = result;
+    return true;
+}
+
+
+int
+libgtlm_compositor_render(libgtlm_compositor *compositor)
+{
+    // nothing to flatten, so nothing to send
+    if (compositor == NULL)
+        return LIBUSB_SUCCESS;
+
+    libgtlm_device *device = compositor->device;
+    libgtlm_frame previous = compositor->current;
+    libgtlm_frame frame;
+    uint64_t trace = GTLM_TRACE_BEGIN();
+    bool changed = libgtlm_compositor_flatten(compositor, &frame);
+    GTLM_TRACE_END("frame", "flatten", trace);
+    if (!changed) {
+        device->sync_stats.skipped++;
+        return LIBUSB_SUCCESS;
+    }
+
+    device->led_status = frame.led_status;
+    libgtlm_set_led_mode(device, (libgtlm_led_mode)frame.led_mode,
+        frame.enabled);
+    int result = libgtlm_sync(device);
+    if (result < 0) {
+        // the controller still shows the previous frame: the next render
+        // has to flatten and send this one again
+        compositor->current = previous;
+        compositor->dirty_zones = LEDS_ALL;
+        compositor->dirty_mode = true;
+    }
+    GTLM_TRACE_END("frame", "render", trace);
+    return result;
+}
+
+
+uint64_t
+libgtlm_compositor_next_expiry(libgtlm_compositor *compositor)
+{
+    if (compositor == NULL)
+        return 0;
+
+    uint64_t next = 0;
+    for (int i = 0; i < compositor->count; i++) {
+        uint64_t expires = compositor->layers[compositor->order[i]].expires;
+        if (expires != 0 && (next == 0 || expires < next))
+            next = expires;
+    }
+    return next;
+}
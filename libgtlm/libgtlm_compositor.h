@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_COMPOSITOR_H__
+#define __LIBGTLM_COMPOSITOR_H__
+
+#include "libgtlm.h"
+
+#define GTLM_MAX_LAYERS              16
+
+typedef struct libgtlm_compositor libgtlm_compositor;
+
+// Stacks independent producers (base pattern, alerts, highlights) on one
+// controller. Each layer owns a zone mask and may override the mode; per
+// zone the highest-priority live layer wins, and the mode comes from the
+// highest-priority layer that sets one. Zones and mode nobody claims keep
+// the device state captured at creation. A non-zero lifetime (ms) clears
+// the whole layer once it runs out; each set call restarts it.
+libgtlm_compositor* libgtlm_compositor_new(libgtlm_device *device);
+void libgtlm_compositor_free(libgtlm_compositor *compositor);
+
+int libgtlm_compositor_add_layer(libgtlm_compositor *compositor, int priority);
+void libgtlm_compositor_remove_layer(libgtlm_compositor *compositor, int layer);
+void libgtlm_compositor_set_zones(libgtlm_compositor *compositor, int layer,
+    uint8_t zones, uint8_t status, uint32_t lifetime);
+void libgtlm_compositor_set_mode(libgtlm_compositor *compositor, int layer,
+    libgtlm_led_mode mode, bool enable, uint32_t lifetime);
+void libgtlm_compositor_clear(libgtlm_compositor *compositor, int layer);
+
+// Expires layers and re-flattens only the zones touched since the last call.
+// Returns true and fills frame when the result differs from the last one.
+bool libgtlm_compositor_flatten(libgtlm_compositor *compositor,
+    libgtlm_frame *frame);
+// Flattens and syncs the device if anything changed.
+int libgtlm_compositor_render(libgtlm_compositor *compositor);
+// Earliest layer expiry (libgtlm_time_ns()), or 0 if nothing expires.
+uint64_t libgtlm_compositor_next_expiry(libgtlm_compositor *compositor);
+
+#endif // __LIBGTLM_COMPOSITOR_H__
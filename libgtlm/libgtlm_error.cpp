@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "libgtlm.h"
+
+static_assert((GTLM_ERROR_RING_SIZE & (GTLM_ERROR_RING_SIZE - 1)) == 0,
+    "GTLM_ERROR_RING_SIZE must be a power of two");
+
+// Bounded multi-producer queue; each cell carries a sequence number telling
+// producers and the consumer whose turn it is, so neither side takes a lock.
+typedef struct libgtlm_error_cell {
+    std::atomic<uint64_t> sequence;
+    libgtlm_error_entry entry;
+} libgtlm_error_cell;
+
+static libgtlm_error_cell gErrorRing[GTLM_ERROR_RING_SIZE];
+static std::atomic<uint64_t> gErrorHead(0);
+static std::atomic<uint64_t> gErrorTail(0);
+static std::atomic<uint64_t> gErrorDropped(0);
+static std::atomic<uint64_t> gErrorCounts[GTLM_ERROR_CODES];
+static std::once_flag gErrorRingInit;
+
+static std::thread gLoggerThread;
+static std::mutex gLoggerLock;
+static std::condition_variable gLoggerWake;
+static std::atomic<bool> gLoggerRunning(false);
+static FILE *gLoggerStream = NULL;
+
+
+static void
+libgtlm_error_ring_init()
+{
+    for (uint64_t i = 0; i < GTLM_ERROR_RING_SIZE; i++)
+        gErrorRing[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+
+static int
+libgtlm_error_slot(int error)
+{
+    return error < 0 && error > -GTLM_ERROR_CODES ? -error : 0;
+}
+
+
+void
+libgtlm_report_error(int error, int line, const char *file)
+{
+    std::call_once(gErrorRingInit, libgtlm_error_ring_init);
+    gErrorCounts[libgtlm_error_slot(error)].fetch_add(1,
+        std::memory_order_relaxed);
+
+    uint64_t timestamp = libgtlm_time_ns();
+    uint64_t position = gErrorHead.load(std::memory_order_relaxed);
+    libgtlm_error_cell *cell = NULL;
+    for (;;) {
+        cell = &gErrorRing[position & (GTLM_ERROR_RING_SIZE - 1)];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)position;
+        if (diff == 0) {
+            if (gErrorHead.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            gErrorDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else
+            position = gErrorHead.load(std::memory_order_relaxed);
+    }
+
+    cell->entry.timestamp = timestamp;
+    cell->entry.error = error;
+    cell->entry.line = line;
+    cell->entry.file = file;
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    if (gLoggerRunning.load(std::memory_order_relaxed))
+        gLoggerWake.notify_one();
+}
+
+
+bool
+libgtlm_pop_error(libgtlm_error_entry *entry)
+{
+    std::call_once(gErrorRingInit, libgtlm_error_ring_init);
+
+    uint64_t position = gErrorTail.load(std::memory_order_relaxed);
+    for (;;) {
+        libgtlm_error_cell *cell =
+            &gErrorRing[position & (GTLM_ERROR_RING_SIZE - 1)];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)(position + 1);
+        if (diff == 0) {
+            if (gErrorTail.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed)) {
+                if (entry)
+                    *entry = cell->entry;
+                cell->sequence.store(position + GTLM_ERROR_RING_SIZE,
+                    std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0)
+            return false;
+        else
+            position = gErrorTail.load(std::memory_order_relaxed);
+    }
+}
+
+
+uint64_t
+libgtlm_dropped_errors()
+{
+    return gErrorDropped.load(std::memory_order_relaxed);
+}
+
+
+uint64_t
+libgtlm_error_count(int error)
+{
+    return gErrorCounts[libgtlm_error_slot(error)].load(
+        std::memory_order_relaxed);
+}
+
+
+const char*
+libgtlm_error_name(int error)
+{
+    switch (error) {
+    case LIBUSB_ERROR_IO:
+        return "IO";
+    case LIBUSB_ERROR_INVALID_PARAM:
+        return "INVALID PARAM";
+    case LIBUSB_ERROR_ACCESS:
+        return "ACCESS";
+    case LIBUSB_ERROR_NOT_FOUND:
+        return "NOT FOUND";
+    case LIBUSB_ERROR_BUSY:
+        return "BUSY";
+    case LIBUSB_ERROR_OVERFLOW:
+        return "OVERFLOW";
+    case LIBUSB_ERROR_INTERRUPTED:
+        return "INTERRUPTED";
+    case LIBUSB_ERROR_NO_MEM:
+        return "NO MEMORY";
+    case LIBUSB_ERROR_NOT_SUPPORTED:
+        return "NOT SUPPORTED";
+    case LIBUSB_ERROR_TIMEOUT:
+        return "TIMEOUT";
+    case LIBUSB_ERROR_PIPE:
+        return "PIPE";
+    case LIBUSB_ERROR_NO_DEVICE:
+        return "NO DEVICE";
+    default:
+        return NULL;
+    }
+}
+
+
+static void
+libgtlm_print_error(FILE *stream, int error, int line, const char *file)
+{
+    const char *name = libgtlm_error_name(error);
+    if (name)
+        fprintf(stream, "ERROR: %s:%d:%s\n", file, line, name);
+    else
+        fprintf(stream, "ERROR: %s:%d:%d\n", file, line, error);
+}
+
+
+void
+print_libusb_error(int error, int line, const char *file)
+{
+    libgtlm_print_error(stderr, error, line, file);
+}
+
+
+static void
+libgtlm_drain_errors(FILE *stream)
+{
+    libgtlm_error_entry entry;
+    while (libgtlm_pop_error(&entry))
+        libgtlm_print_error(stream, entry.error, entry.line, entry.file);
+
+    libgtlm_log_entry log;
+    while (libgtlm_pop_log(&log))
+        libgtlm_print_log(stream, &log);
+}
+
+
+static void
+libgtlm_error_logger()
+{
+    std::unique_lock<std::mutex> lock(gLoggerLock);
+    while (gLoggerRunning.load(std::memory_order_relaxed)) {
+        lock.unlock();
+        libgtlm_drain_errors(gLoggerStream);
+        fflush(gLoggerStream);
+        lock.lock();
+        // Producers notify without the lock, so a wake can slip in between
+        // the drain and the wait; the timeout bounds how late that entry is.
+        gLoggerWake.wait_for(lock, std::chrono::seconds(1));
+    }
+}
+
+
+bool
+libgtlm_start_error_logger(FILE *stream)
+{
+    if (stream == NULL || gLoggerRunning.load())
+        return false;
+
+    gLoggerStream = stream;
+    gLoggerRunning.store(true);
+    gLoggerThread = std::thread(libgtlm_error_logger);
+    return true;
+}
+
+
+void
+libgtlm_wake_error_logger()
+{
+    if (gLoggerRunning.load(std::memory_order_relaxed))
+        gLoggerWake.notify_one();
+}
+
+
+void
+libgtlm_stop_error_logger()
+{
+    if (!gLoggerRunning.load())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(gLoggerLock);
+        gLoggerRunning.store(false);
+    }
+    gLoggerWake.notify_one();
+    gLoggerThread.join();
+    libgtlm_drain_errors(gLoggerStream);
+    fflush(gLoggerStream);
+    gLoggerStream = NULL;
+}
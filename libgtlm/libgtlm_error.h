@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_ERROR_H__
+#define __LIBGTLM_ERROR_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Must be a power of two.
+#define GTLM_ERROR_RING_SIZE         256
+// libusb_error codes -1 to -12; anything else is counted in slot 0
+#define GTLM_ERROR_CODES             13
+
+// Failed operations are recorded here instead of being printed. Recording
+// never blocks and never allocates; when the ring is full the newest entry
+// is dropped and counted.
+typedef struct libgtlm_error_entry {
+    uint64_t timestamp;         // libgtlm_time_ns()
+    int error;                  // libusb_error code
+    int line;
+    const char *file;
+} libgtlm_error_entry;
+
+#define GTLM_REPORT_ERROR(error) \
+    libgtlm_report_error((error), __LINE__, __FILE__)
+
+void libgtlm_report_error(int error, int line, const char *file);
+bool libgtlm_pop_error(libgtlm_error_entry *entry);
+uint64_t libgtlm_dropped_errors();
+// Errors reported so far with this code, dropped ones included.
+uint64_t libgtlm_error_count(int error);
+const char* libgtlm_error_name(int error);
+
+// Optional background thread that drains this ring and the log ring
+// (libgtlm_log.h) into stream. Stopping it flushes whatever is still queued.
+bool libgtlm_start_error_logger(FILE *stream);
+void libgtlm_stop_error_logger();
+// Hurries the logger thread along, e.g. when the log ring fills up.
+void libgtlm_wake_error_logger();
+
+#endif // __LIBGTLM_ERROR_H__
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "libgtlm_exporter.h"
+#include "libgtlm_monitor.h"
+
+static const char *kCommandNames[CMD_COUNT] = {
+    "set_led_status", "set_led_mode", "get_version", "get_led_mode"
+};
+
+static const double kQuantiles[] = { 0.5, 0.9, 0.99 };
+
+struct libgtlm_exporter {
+    char *path;
+    char *temp_path;
+    uint64_t interval;
+    uint64_t last;
+    libgtlm_pacer *pacer;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running;
+    bool pending;
+    libgtlm_monitor_snapshot snapshot;
+};
+
+
+static void
+libgtlm_write_counter(FILE *file, const char *name, const char *help,
+    uint64_t value)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help,
+        name, name, (unsigned long long)value);
+}
+
+
+static void
+libgtlm_write_gauge(FILE *file, const char *name, const char *help,
+    uint64_t value)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help,
+        name, name, (unsigned long long)value);
+}
+
+
+static void
+libgtlm_exporter_format(FILE *file, const libgtlm_monitor_snapshot *snapshot)
+{
+    libgtlm_write_counter(file, "gtlm_syncs_total", "Device syncs.",
+        snapshot->sync.syncs);
+    libgtlm_write_counter(file, "gtlm_verifications_total",
+        "Fire-and-forget state verifications.", snapshot->sync.verifications);
+    libgtlm_write_counter(file, "gtlm_drifts_total",
+        "Verifications that found the device off.", snapshot->sync.drifts);
+    libgtlm_write_counter(file, "gtlm_syncs_skipped_total",
+        "Syncs left out because nothing changed.", snapshot->sync.skipped);
+
+    fprintf(file, "# HELP gtlm_transfer_latency_seconds OUT/IN round trips.\n"
+        "# TYPE gtlm_transfer_latency_seconds summary\n");
+    for (int i = 0; i < CMD_COUNT; i++) {
+        const libgtlm_latency *latency = &snapshot->latency[i];
+        for (size_t q = 0; q < sizeof(kQuantiles) / sizeof(kQuantiles[0]); q++)
+            fprintf(file, "gtlm_transfer_latency_seconds{command=\"%s\","
+                "quantile=\"%g\"} %.9f\n", kCommandNames[i], kQuantiles[q],
+                libgtlm_latency_quantile(latency, kQuantiles[q]) / 1e9);
+        fprintf(file, "gtlm_transfer_latency_seconds_sum{command=\"%s\"} %.9f\n",
+            kCommandNames[i], latency->sum / 1e9);
+        fprintf(file, "gtlm_transfer_latency_seconds_count{command=\"%s\"} %llu\n",
+            kCommandNames[i], (unsigned long long)latency->count);
+    }
+
+    fprintf(file, "# HELP gtlm_errors_total Failed operations by libusb error.\n"
+        "# TYPE gtlm_errors_total counter\n");
+    for (int i = 0; i < GTLM_ERROR_CODES; i++) {
+        const char *name = libgtlm_error_name(-i);
+        fprintf(file, "gtlm_errors_total{code=\"%d\",name=\"%s\"} %llu\n",
+            -i, (i && name) ? name : "OTHER",
+            (unsigned long long)snapshot->errors[i]);
+    }
+    libgtlm_write_counter(file, "gtlm_errors_dropped_total",
+        "Errors lost to a full error ring.", snapshot->dropped_errors);
+
+    libgtlm_write_counter(file, "gtlm_device_losses_total",
+        "Times the controller went away.", snapshot->reconnect.losses);
+    libgtlm_write_counter(file, "gtlm_reconnects_total",
+        "Times the controller was re-opened.", snapshot->reconnect.reconnects);
+    fprintf(file, "# HELP gtlm_last_recovery_seconds Loss to replayed state, "
+        "last reconnect.\n# TYPE gtlm_last_recovery_seconds gauge\n"
+        "gtlm_last_recovery_seconds %.9f\n",
+        snapshot->reconnect.last_recovery / 1e9);
+
+    if (snapshot->has_pacer) {
+        const libgtlm_pacer_stats *pacer = &snapshot->pacer;
+        libgtlm_write_counter(file, "gtlm_frames_submitted_total",
+            "Frames handed to the pacer.", pacer->submitted);
+        libgtlm_write_counter(file, "gtlm_frames_rendered_total",
+            "Frames the pacer sent to the device.", pacer->sent);
+        libgtlm_write_counter(file, "gtlm_frames_dropped_total",
+            "Frames superseded before they were sent.", pacer->dropped);
+        libgtlm_write_gauge(file, "gtlm_queue_depth",
+            "Frames waiting in the pacer.",
+            pacer->submitted - pacer->sent - pacer->dropped);
+
+        fprintf(file, "# HELP gtlm_queue_latency_seconds Frame submit to "
+            "hand-off to the device.\n"
+            "# TYPE gtlm_queue_latency_seconds summary\n");
+        for (int i = 0; i < PRIORITY_COUNT; i++) {
+            const libgtlm_latency *latency = &pacer->classes[i].queued;
+            const char *name = libgtlm_priority_name((libgtlm_priority)i);
+            for (size_t q = 0; q < sizeof(kQuantiles) / sizeof(kQuantiles[0]); q++)
+                fprintf(file, "gtlm_queue_latency_seconds{class=\"%s\","
+                    "quantile=\"%g\"} %.9f\n", name, kQuantiles[q],
+                    libgtlm_latency_quantile(latency, kQuantiles[q]) / 1e9);
+            fprintf(file, "gtlm_queue_latency_seconds_sum{class=\"%s\"} %.9f\n",
+                name, latency->sum / 1e9);
+            fprintf(file, "gtlm_queue_latency_seconds_count{class=\"%s\"} %llu\n",
+                name, (unsigned long long)latency->count);
+        }
+    }
+}
+
+
+// The collector may read at any moment, so it must only ever see a whole
+// file: write aside, flush to disk, rename over.
+static bool
+libgtlm_exporter_write(libgtlm_exporter *exporter,
+    const libgtlm_monitor_snapshot *snapshot)
+{
+    FILE *file = fopen(exporter->temp_path, "we");
+    if (file == NULL)
+        return false;
+
+    libgtlm_exporter_format(file, snapshot);
+    bool written = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (written)
+        written = rename(exporter->temp_path, exporter->path) == 0;
+    if (!written)
+        unlink(exporter->temp_path);
+    return written;
+}
+
+
+static void
+libgtlm_exporter_thread(libgtlm_exporter *exporter)
+{
+    libgtlm_monitor_snapshot snapshot;
+    std::unique_lock<std::mutex> lock(exporter->lock);
+    while (exporter->running || exporter->pending) {
+        if (!exporter->pending) {
+            exporter->wake.wait(lock);
+            continue;
+        }
+        snapshot = exporter->snapshot;
+        exporter->pending = false;
+        lock.unlock();
+        libgtlm_exporter_write(exporter, &snapshot);
+        lock.lock();
+    }
+}
+
+
+static char*
+libgtlm_exporter_path(const char *directory, const char *suffix)
+{
+    int len = strlen(directory) + strlen(GTLM_EXPORTER_FILE)
+        + strlen(suffix) + 2;
+    char *path = (char*)malloc(len);
+    if (path)
+        snprintf(path, len, "%s/%s%s", directory, GTLM_EXPORTER_FILE, suffix);
+    return path;
+}
+
+
+libgtlm_exporter*
+libgtlm_exporter_new(const char *directory, uint32_t interval)
+{
+    if (directory == NULL)
+        return NULL;
+
+    libgtlm_exporter *exporter = new libgtlm_exporter;
+    // node_exporter skips files not ending in .prom
+    exporter->path = libgtlm_exporter_path(directory, "");
+    exporter->temp_path = libgtlm_exporter_path(directory, ".tmp");
+    if (exporter->path == NULL || exporter->temp_path == NULL) {
+        free(exporter->path);
+        free(exporter->temp_path);
+        delete exporter;
+        return NULL;
+    }
+
+    exporter->interval = (uint64_t)interval * 1000000;
+    exporter->last = 0;
+    exporter->pacer = NULL;
+    exporter->running = true;
+    exporter->pending = false;
+    memset(&exporter->snapshot, 0, sizeof(exporter->snapshot));
+    exporter->thread = std::thread(libgtlm_exporter_thread, exporter);
+    return exporter;
+}
+
+
+void
+libgtlm_exporter_free(libgtlm_exporter *exporter)
+{
+    if (exporter == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(exporter->lock);
+        exporter->running = false;
+    }
+    exporter->wake.notify_one();
+    exporter->thread.join();
+    free(exporter->path);
+    free(exporter->temp_path);
+    delete exporter;
+}
+
+
+void
+libgtlm_exporter_set_pacer(libgtlm_exporter *exporter, libgtlm_pacer *pacer)
+{
+    if (exporter)
+        exporter->pacer = pacer;
+}
+
+
+bool
+libgtlm_exporter_collect(libgtlm_exporter *exporter, libgtlm_device *device)
+{
+    if (exporter == NULL || device == NULL)
+        return false;
+
+    uint64_t now = libgtlm_time_ns();
+    if (exporter->last != 0 && now - exporter->last < exporter->interval)
+        return false;
+    exporter->last = now;
+
+    {
+        // the writer only holds the lock to copy the snapshot out
+        std::lock_guard<std::mutex> lock(exporter->lock);
+        libgtlm_monitor_collect(device, exporter->pacer, &exporter->snapshot);
+        exporter->pending = true;
+    }
+    exporter->wake.notify_one();
+    return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_EXPORTER_H__
+#define __LIBGTLM_EXPORTER_H__
+
+#include "libgtlm.h"
+#include "libgtlm_pacer.h"
+
+#define GTLM_EXPORTER_FILE           "gtlm.prom"
+// ms between writes for long-running tools
+#define GTLM_EXPORTER_INTERVAL       15000
+
+typedef struct libgtlm_exporter libgtlm_exporter;
+
+// Prometheus textfile-collector output (Linux only), for node_exporter's
+// --collector.textfile.directory. collect() is meant to be called from the
+// thread that owns the device, as often as is convenient: until interval
+// ms have passed it only compares a timestamp, and then it copies the
+// counters into a snapshot. Formatting and writing <directory>/gtlm.prom,
+// through a temporary file renamed over it, happen on the exporter's own
+// thread.
+libgtlm_exporter* libgtlm_exporter_new(const char *directory,
+    uint32_t interval);
+// Writes the last snapshot taken, if it is still pending.
+void libgtlm_exporter_free(libgtlm_exporter *exporter);
+// Adds frame and queue figures; the pacer must outlive the exporter.
+void libgtlm_exporter_set_pacer(libgtlm_exporter *exporter,
+    libgtlm_pacer *pacer);
+// True when a snapshot was taken.
+bool libgtlm_exporter_collect(libgtlm_exporter *exporter,
+    libgtlm_device *device);
+
+#endif // __LIBGTLM_EXPORTER_H__
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <chrono>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include "libgtlm_fault.h"
+
+
+struct libgtlm_fault {
+    libgtlm_transport transport;
+    libgtlm_transport *inner;
+    std::mutex lock;
+    libgtlm_fault_rule rules[GTLM_FAULT_MAX_RULES];
+    uint32_t remaining[GTLM_FAULT_MAX_RULES];
+    int rule_count;
+    uint64_t random;
+    void (*delay)(void *data, uint64_t ns);
+    void *delay_data;
+    libgtlm_fault_stats stats;
+};
+
+
+// xorshift64*
+static uint64_t
+libgtlm_fault_random(libgtlm_fault *fault)
+{
+    fault->random ^= fault->random >> 12;
+    fault->random ^= fault->random << 25;
+    fault->random ^= fault->random >> 27;
+    return fault->random * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void
+libgtlm_fault_sleep(void *data, uint64_t ns)
+{
+    (void)data;
+    std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+}
+
+
+// Runs the rules for one stage; returns the first error that fires and
+// adds up the delays of every rule that fires.
+static int
+libgtlm_fault_pick(libgtlm_fault *fault, libgtlm_fault_stage stage,
+    libgtlm_command command, uint64_t *delay)
+{
+    int error = 0;
+    for (int i = 0; i < fault->rule_count; i++) {
+        const libgtlm_fault_rule *rule = &fault->rules[i];
+        if ((rule->stages & stage) == 0)
+            continue;
+        if (rule->commands != 0
+            && (command >= CMD_COUNT || (rule->commands & (1 << command)) == 0))
+            continue;
+
+        if (fault->remaining[i] > 0)
+            fault->remaining[i]--;
+        else if (rule->rate != 0
+            && libgtlm_fault_random(fault) % 1000000 < rule->rate)
+            fault->remaining[i] = rule->burst > 1 ? rule->burst - 1 : 0;
+        else
+            continue;
+
+        if (rule->delay) {
+            *delay += (uint64_t)rule->delay * 1000;
+            fault->stats.delayed++;
+        }
+        if (rule->error < 0 && error == 0) {
+            error = rule->error;
+            fault->stats.injected++;
+        }
+    }
+    return error;
+}
+
+
+static int
+libgtlm_fault_transfer(libgtlm_transport *transport, bool readBack)
+{
+    libgtlm_fault *fault = (libgtlm_fault*)transport;
+    libgtlm_command command = libgtlm_decode(*transport->request);
+    uint64_t delay = 0;
+    int outError = 0;
+    int inError = 0;
+    {
+        std::lock_guard<std::mutex> lock(fault->lock);
+        fault->stats.transfers++;
+        outError = libgtlm_fault_pick(fault, FAULT_OUT, command, &delay);
+        if (readBack && outError == 0)
+            inError = libgtlm_fault_pick(fault, FAULT_IN, command, &delay);
+    }
+
+    if (delay)
+        fault->delay(fault->delay_data, delay);
+    if (outError < 0)
+        return outError;
+
+    int result = fault->inner->transfer(fault->inner, readBack);
+    if (result < 0)
+        return result;
+
+    return inError < 0 ? inError : result;
+}
+
+
+libgtlm_fault*
+libgtlm_fault_new(libgtlm_transport *inner, uint64_t seed)
+{
+    if (inner == NULL)
+        return NULL;
+
+    libgtlm_fault *fault = new libgtlm_fault;
+    fault->transport.request = inner->request;
+    fault->transport.reply = inner->reply;
+    fault->transport.transfer = libgtlm_fault_transfer;
+    fault->inner = inner;
+    fault->rule_count = 0;
+    // xorshift must not start from zero
+    fault->random = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    fault->delay = libgtlm_fault_sleep;
+    fault->delay_data = NULL;
+    memset(&fault->stats, 0, sizeof(fault->stats));
+    return fault;
+}
+
+
+void
+libgtlm_fault_free(libgtlm_fault *fault)
+{
+    delete fault;
+}
+
+
+libgtlm_transport*
+libgtlm_fault_get_transport(libgtlm_fault *fault)
+{
+    return fault ? &fault->transport : NULL;
+}
+
+
+bool
+libgtlm_fault_add_rule(libgtlm_fault *fault, const libgtlm_fault_rule *rule)
+{
+    if (fault == NULL || rule == NULL || rule->stages == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(fault->lock);
+    if (fault->rule_count == GTLM_FAULT_MAX_RULES)
+        return false;
+
+    fault->rules[fault->rule_count] = *rule;
+    fault->remaining[fault->rule_count] = 0;
+    fault->rule_count++;
+    return true;
+}
+
+
+void
+libgtlm_fault_clear_rules(libgtlm_fault *fault)
+{
+    if (fault == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(fault->lock);
+    fault->rule_count = 0;
+}
+
+
+void
+libgtlm_fault_set_delay(libgtlm_fault *fault,
+    void (*delay)(void *data, uint64_t ns), void *data)
+{
+    if (fault == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(fault->lock);
+    fault->delay = delay ? delay : libgtlm_fault_sleep;
+    fault->delay_data = delay ? data : NULL;
+}
+
+
+void
+libgtlm_fault_get_stats(libgtlm_fault *fault, libgtlm_fault_stats *stats)
+{
+    if (fault == NULL || stats == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(fault->lock);
+    *stats = fault->stats;
+}
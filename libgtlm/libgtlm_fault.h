@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_FAULT_H__
+#define __LIBGTLM_FAULT_H__
+
+#include "libgtlm.h"
+
+typedef struct libgtlm_fault libgtlm_fault;
+
+#define GTLM_FAULT_MAX_RULES         8
+
+// FAULT_OUT fails a request before it reaches the controller; FAULT_IN
+// lets the OUT packet through and fails the read-back, so the controller
+// has applied a request the library sees as failed.
+enum libgtlm_fault_stage {
+    FAULT_OUT       = 0x01,
+    FAULT_IN        = 0x02
+};
+
+typedef struct libgtlm_fault_rule {
+    int error;                  // libusb_error to return, 0 to only delay
+    uint32_t rate;              // per million transfers reaching the stage
+    uint32_t burst;             // stages failed in a row once triggered
+    uint32_t delay;             // microseconds added before the stage ends
+    uint8_t stages;             // libgtlm_fault_stage bits
+    uint8_t commands;           // bit per libgtlm_command, 0 for all
+} libgtlm_fault_rule;
+
+typedef struct libgtlm_fault_stats {
+    uint64_t transfers;
+    uint64_t injected;
+    uint64_t delayed;
+} libgtlm_fault_stats;
+
+// Wraps another transport and injects errors and delays by rule, drawing
+// from a seeded generator. Delays sleep by default; set_delay() replaces
+// that, e.g. with libgtlm_sim_advance() under a virtual clock. The inner
+// transport must outlive the wrapper.
+libgtlm_fault* libgtlm_fault_new(libgtlm_transport *inner, uint64_t seed);
+void libgtlm_fault_free(libgtlm_fault *fault);
+libgtlm_transport* libgtlm_fault_get_transport(libgtlm_fault *fault);
+bool libgtlm_fault_add_rule(libgtlm_fault *fault, const libgtlm_fault_rule *rule);
+void libgtlm_fault_clear_rules(libgtlm_fault *fault);
+void libgtlm_fault_set_delay(libgtlm_fault *fault,
+    void (*delay)(void *data, uint64_t ns), void *data);
+void libgtlm_fault_get_stats(libgtlm_fault *fault, libgtlm_fault_stats *stats);
+
+#endif // __LIBGTLM_FAULT_H__
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <mutex>
+#include "libgtlm.h"
+
+static_assert((GTLM_LOG_RING_SIZE & (GTLM_LOG_RING_SIZE - 1)) == 0,
+    "GTLM_LOG_RING_SIZE must be a power of two");
+
+static const char *kLevelNames[] = {
+    "off", "error", "warn", "info", "debug", "trace"
+};
+
+static const char *kSubsystemNames[SUBSYSTEM_COUNT] = {
+    "core", "transfer", "reconnect", "broker", "scheduler"
+};
+
+// Same bounded multi-producer queue as the error ring.
+typedef struct libgtlm_log_cell {
+    std::atomic<uint64_t> sequence;
+    libgtlm_log_entry entry;
+} libgtlm_log_cell;
+
+std::atomic<uint8_t> libgtlm_log_levels[SUBSYSTEM_COUNT] = {
+    { LEVEL_WARN }, { LEVEL_WARN }, { LEVEL_WARN }, { LEVEL_WARN },
+    { LEVEL_WARN }
+};
+
+static libgtlm_log_cell gLogRing[GTLM_LOG_RING_SIZE];
+static std::atomic<uint64_t> gLogHead(0);
+static std::atomic<uint64_t> gLogTail(0);
+static std::atomic<uint64_t> gLogDropped(0);
+static std::once_flag gLogRingInit;
+
+
+static void
+libgtlm_log_ring_init()
+{
+    for (uint64_t i = 0; i < GTLM_LOG_RING_SIZE; i++)
+        gLogRing[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+
+void
+libgtlm_log_write(libgtlm_log_subsystem subsystem, libgtlm_log_level level,
+    const char *format, ...)
+{
+    std::call_once(gLogRingInit, libgtlm_log_ring_init);
+
+    uint64_t timestamp = libgtlm_time_ns();
+    uint64_t position = gLogHead.load(std::memory_order_relaxed);
+    libgtlm_log_cell *cell = NULL;
+    for (;;) {
+        cell = &gLogRing[position & (GTLM_LOG_RING_SIZE - 1)];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)position;
+        if (diff == 0) {
+            if (gLogHead.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            gLogDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else
+            position = gLogHead.load(std::memory_order_relaxed);
+    }
+
+    cell->entry.timestamp = timestamp;
+    cell->entry.subsystem = subsystem;
+    cell->entry.level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(cell->entry.message, sizeof(cell->entry.message), format, args);
+    va_end(args);
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    // The logger drains on its own timer; it is only hurried along when
+    // the ring is half full, so a write normally makes no system call.
+    if (position - gLogTail.load(std::memory_order_relaxed)
+            == GTLM_LOG_RING_SIZE / 2)
+        libgtlm_wake_error_logger();
+}
+
+
+bool
+libgtlm_pop_log(libgtlm_log_entry *entry)
+{
+    std::call_once(gLogRingInit, libgtlm_log_ring_init);
+
+    uint64_t position = gLogTail.load(std::memory_order_relaxed);
+    for (;;) {
+        libgtlm_log_cell *cell =
+            &gLogRing[position & (GTLM_LOG_RING_SIZE - 1)];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)(position + 1);
+        if (diff == 0) {
+            if (gLogTail.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed)) {
+                if (entry)
+                    *entry = cell->entry;
+                cell->sequence.store(position + GTLM_LOG_RING_SIZE,
+                    std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0)
+            return false;
+        else
+            position = gLogTail.load(std::memory_order_relaxed);
+    }
+}
+
+
+uint64_t
+libgtlm_dropped_logs()
+{
+    return gLogDropped.load(std::memory_order_relaxed);
+}
+
+
+void
+libgtlm_print_log(FILE *stream, const libgtlm_log_entry *entry)
+{
+    fprintf(stream, "[%12.6f] %-9s %-5s %s\n", entry->timestamp / 1e9,
+        entry->subsystem < SUBSYSTEM_COUNT
+            ? kSubsystemNames[entry->subsystem] : "?",
+        entry->level <= LEVEL_TRACE ? kLevelNames[entry->level] : "?",
+        entry->message);
+}
+
+
+void
+libgtlm_set_log_level(libgtlm_log_subsystem subsystem, libgtlm_log_level level)
+{
+    for (int i = 0; i < SUBSYSTEM_COUNT; i++) {
+        if (subsystem == SUBSYSTEM_COUNT || subsystem == i)
+            libgtlm_log_levels[i].store(level, std::memory_order_relaxed);
+    }
+}
+
+
+static int
+libgtlm_find_name(const char *name, size_t length, const char **names,
+    int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == length && strncmp(names[i], name, length) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+bool
+libgtlm_set_log_levels(const char *spec)
+{
+    if (spec == NULL)
+        return false;
+
+    const int levelCount = sizeof(kLevelNames) / sizeof(kLevelNames[0]);
+    while (*spec) {
+        size_t length = strcspn(spec, ",");
+        const char *equals = (const char*)memchr(spec, '=', length);
+        int subsystem = SUBSYSTEM_COUNT;
+        const char *level = spec;
+        if (equals) {
+            subsystem = libgtlm_find_name(spec, equals - spec,
+                kSubsystemNames, SUBSYSTEM_COUNT);
+            level = equals + 1;
+        }
+        int value = libgtlm_find_name(level, spec + length - level,
+            kLevelNames, levelCount);
+        if (subsystem < 0 || value < 0)
+            return false;
+
+        libgtlm_set_log_level((libgtlm_log_subsystem)subsystem,
+            (libgtlm_log_level)value);
+        spec += length;
+        if (*spec == ',')
+            spec++;
+    }
+    return true;
+}
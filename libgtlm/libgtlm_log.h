@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_LOG_H__
+#define __LIBGTLM_LOG_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+// Must be a power of two.
+#define GTLM_LOG_RING_SIZE           1024
+#define GTLM_LOG_MESSAGE_SIZE        112
+
+enum libgtlm_log_level {
+    LEVEL_OFF       = 0,
+    LEVEL_ERROR,
+    LEVEL_WARN,
+    LEVEL_INFO,
+    LEVEL_DEBUG,
+    LEVEL_TRACE
+};
+
+enum libgtlm_log_subsystem {
+    SUBSYSTEM_CORE      = 0,    // open, config, sync
+    SUBSYSTEM_TRANSFER,         // every packet on the transport
+    SUBSYSTEM_RECONNECT,
+    SUBSYSTEM_BROKER,
+    SUBSYSTEM_SCHEDULER,        // pacer, pwm, compositor
+    SUBSYSTEM_COUNT
+};
+
+// Levels above this are compiled out, call sites and arguments included;
+// release builds keep no logging branches in the transfer paths.
+#ifndef GTLM_LOG_MAX_LEVEL
+#ifdef DEBUG_LIBGTLM
+#define GTLM_LOG_MAX_LEVEL           LEVEL_TRACE
+#else
+#define GTLM_LOG_MAX_LEVEL           LEVEL_INFO
+#endif
+#endif
+
+typedef struct libgtlm_log_entry {
+    uint64_t timestamp;         // libgtlm_time_ns()
+    uint8_t subsystem;
+    uint8_t level;
+    char message[GTLM_LOG_MESSAGE_SIZE];
+} libgtlm_log_entry;
+
+extern std::atomic<uint8_t> libgtlm_log_levels[SUBSYSTEM_COUNT];
+
+inline bool
+libgtlm_log_enabled(libgtlm_log_subsystem subsystem, libgtlm_log_level level)
+{
+    return level <= libgtlm_log_levels[subsystem].load(
+        std::memory_order_relaxed);
+}
+
+#define GTLM_LOG_ENABLED(subsystem, level) \
+    ((level) <= GTLM_LOG_MAX_LEVEL && libgtlm_log_enabled((subsystem), (level)))
+
+#define GTLM_LOG(subsystem, level, ...) \
+    do { \
+        if (GTLM_LOG_ENABLED(subsystem, level)) \
+            libgtlm_log_write((subsystem), (level), __VA_ARGS__); \
+    } while (0)
+
+// Formats into a lock-free ring; never blocks, allocates or makes a system
+// call, so tracing leaves transfer timing alone. The error logger thread
+// (libgtlm_start_error_logger) drains it; when the ring is full the message
+// is dropped and counted.
+#ifdef __GNUC__
+__attribute__((format(printf, 3, 4)))
+#endif
+void libgtlm_log_write(libgtlm_log_subsystem subsystem,
+    libgtlm_log_level level, const char *format, ...);
+bool libgtlm_pop_log(libgtlm_log_entry *entry);
+uint64_t libgtlm_dropped_logs();
+void libgtlm_print_log(FILE *stream, const libgtlm_log_entry *entry);
+
+// SUBSYSTEM_COUNT sets every subsystem. Everything starts at LEVEL_WARN.
+void libgtlm_set_log_level(libgtlm_log_subsystem subsystem,
+    libgtlm_log_level level);
+// "debug" or "transfer=trace,core=info"; false on an unknown name.
+bool libgtlm_set_log_levels(const char *spec);
+
+#endif // __LIBGTLM_LOG_H__
@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "libgtlm.h"
+#include "libgtlm_loop.h"
+
+#define GTLM_LOOP_EVENTS             16
+#define GTLM_LOOP_SIGNALS            65
+
+enum libgtlm_source_type {
+    SOURCE_FD,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL,
+    SOURCE_FILE,
+    SOURCE_USB,
+    SOURCE_USB_TIMER
+};
+
+typedef struct libgtlm_source {
+    libgtlm_source_type type;
+    int fd;
+    libgtlm_fd_callback fd_callback;
+    libgtlm_timer_callback timer_callback;
+    void *data;
+    char *name;                 // SOURCE_FILE: file name inside the watched directory
+    bool removed;
+    struct libgtlm_source *next;
+} libgtlm_source;
+
+typedef struct libgtlm_signal_handler {
+    libgtlm_signal_callback callback;
+    void *data;
+} libgtlm_signal_handler;
+
+struct libgtlm_loop {
+    int epoll;
+    libgtlm_source *sources;
+    int signal_fd;
+    sigset_t signals;
+    libgtlm_signal_handler handlers[GTLM_LOOP_SIGNALS];
+    bool usb;
+    libgtlm_source *usb_timer;
+    bool quit;
+    uint64_t wakeups;
+    uint64_t window_start;
+    uint64_t window_wakeups;
+    double wakeup_rate;
+};
+
+
+static libgtlm_source*
+libgtlm_loop_add_source(libgtlm_loop *loop, libgtlm_source_type type, int fd,
+    uint32_t events)
+{
+    libgtlm_source *source = (libgtlm_source*)malloc(sizeof(*source));
+    if (source == NULL)
+        return NULL;
+
+    memset(source, 0, sizeof(*source));
+    source->type = type;
+    source->fd = fd;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+        free(source);
+        return NULL;
+    }
+
+    source->next = loop->sources;
+    loop->sources = source;
+    return source;
+}
+
+
+static libgtlm_source*
+libgtlm_loop_find_source(libgtlm_loop *loop, int fd, libgtlm_source_type type)
+{
+    for (libgtlm_source *source = loop->sources; source; source = source->next) {
+        if (source->fd == fd && source->type == type && !source->removed)
+            return source;
+    }
+    return NULL;
+}
+
+
+// Sources are only unlinked between dispatch batches, since the pending
+// epoll events may still point at them.
+static void
+libgtlm_loop_drop_source(libgtlm_loop *loop, libgtlm_source *source,
+    bool closeFd)
+{
+    epoll_ctl(loop->epoll, EPOLL_CTL_DEL, source->fd, NULL);
+    if (closeFd)
+        close(source->fd);
+    source->removed = true;
+}
+
+
+static void
+libgtlm_loop_reap(libgtlm_loop *loop)
+{
+    libgtlm_source **link = &loop->sources;
+    while (*link) {
+        libgtlm_source *source = *link;
+        if (source->removed) {
+            *link = source->next;
+            free(source->name);
+            free(source);
+        } else
+            link = &source->next;
+    }
+}
+
+
+libgtlm_loop*
+libgtlm_loop_new()
+{
+    libgtlm_loop *loop = (libgtlm_loop*)malloc(sizeof(*loop));
+    if (loop == NULL)
+        return NULL;
+
+    memset(loop, 0, sizeof(*loop));
+    loop->signal_fd = -1;
+    sigemptyset(&loop->signals);
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll < 0) {
+        free(loop);
+        return NULL;
+    }
+
+    loop->window_start = libgtlm_time_ns();
+    return loop;
+}
+
+
+void
+libgtlm_loop_free(libgtlm_loop *loop)
+{
+    if (loop == NULL)
+        return;
+
+    for (libgtlm_source *source = loop->sources; source; source = source->next) {
+        if (source->removed)
+            continue;
+        bool owned = source->type != SOURCE_FD && source->type != SOURCE_USB;
+        libgtlm_loop_drop_source(loop, source, owned);
+    }
+    libgtlm_loop_reap(loop);
+    if (loop->usb)
+        libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+    close(loop->epoll);
+    free(loop);
+}
+
+
+int
+libgtlm_loop_add_fd(libgtlm_loop *loop, int fd, uint32_t events,
+    libgtlm_fd_callback callback, void *data)
+{
+    if (loop == NULL || callback == NULL)
+        return -1;
+
+    libgtlm_source *source = libgtlm_loop_add_source(loop, SOURCE_FD, fd,
+        events);
+    if (source == NULL)
+        return -1;
+
+    source->fd_callback = callback;
+    source->data = data;
+    return 0;
+}
+
+
+void
+libgtlm_loop_remove_fd(libgtlm_loop *loop, int fd)
+{
+    if (loop == NULL)
+        return;
+
+    libgtlm_source *source = libgtlm_loop_find_source(loop, fd, SOURCE_FD);
+    if (source)
+        libgtlm_loop_drop_source(loop, source, false);
+}
+
+
+static int
+libgtlm_loop_arm(int fd, uint64_t initial, uint64_t interval)
+{
+    struct itimerspec spec;
+    spec.it_value.tv_sec = initial / 1000000000ULL;
+    spec.it_value.tv_nsec = initial % 1000000000ULL;
+    spec.it_interval.tv_sec = interval / 1000000000ULL;
+    spec.it_interval.tv_nsec = interval % 1000000000ULL;
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+
+int
+libgtlm_loop_add_timer(libgtlm_loop *loop, uint64_t initial, uint64_t interval,
+    libgtlm_timer_callback callback, void *data)
+{
+    if (loop == NULL || callback == NULL)
+        return -1;
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    libgtlm_source *source = libgtlm_loop_add_source(loop, SOURCE_TIMER, fd,
+        EPOLLIN);
+    if (source == NULL || libgtlm_loop_arm(fd, initial, interval) < 0) {
+        if (source)
+            libgtlm_loop_drop_source(loop, source, false);
+        close(fd);
+        return -1;
+    }
+
+    source->timer_callback = callback;
+    source->data = data;
+    return fd;
+}
+
+
+int
+libgtlm_loop_set_timer(libgtlm_loop *loop, int timer, uint64_t initial,
+    uint64_t interval)
+{
+    if (loop == NULL
+        || libgtlm_loop_find_source(loop, timer, SOURCE_TIMER) == NULL)
+        return -1;
+
+    return libgtlm_loop_arm(timer, initial, interval);
+}
+
+
+void
+libgtlm_loop_remove_timer(libgtlm_loop *loop, int timer)
+{
+    if (loop == NULL)
+        return;
+
+    libgtlm_source *source = libgtlm_loop_find_source(loop, timer,
+        SOURCE_TIMER);
+    if (source)
+        libgtlm_loop_drop_source(loop, source, true);
+}
+
+
+int
+libgtlm_loop_add_signal(libgtlm_loop *loop, int signal,
+    libgtlm_signal_callback callback, void *data)
+{
+    if (loop == NULL || callback == NULL || signal <= 0
+        || signal >= GTLM_LOOP_SIGNALS)
+        return -1;
+
+    sigset_t mask = loop->signals;
+    sigaddset(&mask, signal);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+        return -1;
+
+    int fd = signalfd(loop->signal_fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (loop->signal_fd < 0) {
+        if (libgtlm_loop_add_source(loop, SOURCE_SIGNAL, fd, EPOLLIN) == NULL) {
+            close(fd);
+            return -1;
+        }
+        loop->signal_fd = fd;
+    }
+
+    loop->signals = mask;
+    loop->handlers[signal].callback = callback;
+    loop->handlers[signal].data = data;
+    return 0;
+}
+
+
+int
+libgtlm_loop_watch_file(libgtlm_loop *loop, const char *path,
+    libgtlm_fd_callback callback, void *data)
+{
+    if (loop == NULL || path == NULL || callback == NULL)
+        return -1;
+
+    // Watch the directory: config writers usually replace the file, which
+    // would silently end a watch on the file itself.
+    char *dirCopy = strdup(path);
+    char *nameCopy = strdup(path);
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    libgtlm_source *source = NULL;
+    if (dirCopy && nameCopy && fd >= 0
+        && inotify_add_watch(fd, dirname(dirCopy), IN_CLOSE_WRITE
+            | IN_MOVED_TO | IN_CREATE | IN_DELETE) >= 0)
+        source = libgtlm_loop_add_source(loop, SOURCE_FILE, fd, EPOLLIN);
+
+    if (source == NULL) {
+        if (fd >= 0)
+            close(fd);
+        free(dirCopy);
+        free(nameCopy);
+        return -1;
+    }
+
+    source->name = strdup(basename(nameCopy));
+    source->fd_callback = callback;
+    source->data = data;
+    free(dirCopy);
+    free(nameCopy);
+    return fd;
+}
+
+
+static void LIBUSB_CALL
+libgtlm_loop_usb_added(int fd, short events, void *data)
+{
+    libgtlm_loop *loop = (libgtlm_loop*)data;
+    uint32_t mask = 0;
+    if (events & POLLIN)
+        mask |= EPOLLIN;
+    if (events & POLLOUT)
+        mask |= EPOLLOUT;
+    libgtlm_loop_add_source(loop, SOURCE_USB, fd, mask);
+}
+
+
+static void LIBUSB_CALL
+libgtlm_loop_usb_removed(int fd, void *data)
+{
+    libgtlm_loop *loop = (libgtlm_loop*)data;
+    libgtlm_source *source = libgtlm_loop_find_source(loop, fd, SOURCE_USB);
+    if (source)
+        libgtlm_loop_drop_source(loop, source, false);
+}
+
+
+// Older backends cannot fold their timeouts into the pollfds; keep a timerfd
+// armed for libusb's next deadline in that case.
+static void
+libgtlm_loop_usb_rearm(libgtlm_loop *loop)
+{
+    if (loop->usb_timer == NULL)
+        return;
+
+    struct timeval timeout;
+    if (libusb_get_next_timeout(NULL, &timeout) == 1) {
+        uint64_t ns = (uint64_t)timeout.tv_sec * 1000000000ULL
+            + (uint64_t)timeout.tv_usec * 1000;
+        libgtlm_loop_arm(loop->usb_timer->fd, ns ? ns : 1, 0);
+    } else
+        libgtlm_loop_arm(loop->usb_timer->fd, 0, 0);
+}
+
+
+int
+libgtlm_loop_watch_usb(libgtlm_loop *loop)
+{
+    if (loop == NULL)
+        return -1;
+
+    const struct libusb_pollfd **pollfds = libusb_get_pollfds(NULL);
+    if (pollfds == NULL)
+        return -1;
+
+    for (int i = 0; pollfds[i]; i++)
+        libgtlm_loop_usb_added(pollfds[i]->fd, pollfds[i]->events, loop);
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+    libusb_free_pollfds(pollfds);
+#else
+    free(pollfds);
+#endif
+    libusb_set_pollfd_notifiers(NULL, libgtlm_loop_usb_added,
+        libgtlm_loop_usb_removed, loop);
+    loop->usb = true;
+
+    if (!libusb_pollfds_handle_timeouts(NULL)) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        loop->usb_timer = libgtlm_loop_add_source(loop, SOURCE_USB_TIMER, fd,
+            EPOLLIN);
+        if (loop->usb_timer == NULL) {
+            close(fd);
+            return -1;
+        }
+        libgtlm_loop_usb_rearm(loop);
+    }
+
+    return 0;
+}
+
+
+static void
+libgtlm_loop_dispatch(libgtlm_loop *loop, libgtlm_source *source,
+    uint32_t events)
+{
+    uint64_t expirations;
+    struct timeval zero = { 0, 0 };
+
+    switch (source->type) {
+    case SOURCE_FD:
+        source->fd_callback(loop, source->fd, events, source->data);
+        break;
+    case SOURCE_TIMER:
+        if (read(source->fd, &expirations, sizeof(expirations)) > 0)
+            source->timer_callback(loop, source->fd, source->data);
+        break;
+    case SOURCE_SIGNAL: {
+        struct signalfd_siginfo info;
+        while (read(source->fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo < GTLM_LOOP_SIGNALS
+                && loop->handlers[info.ssi_signo].callback)
+                loop->handlers[info.ssi_signo].callback(loop, info.ssi_signo,
+                    loop->handlers[info.ssi_signo].data);
+        }
+        break;
+    }
+    case SOURCE_FILE: {
+        char buffer[4096]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+        bool matched = false;
+        ssize_t length;
+        while ((length = read(source->fd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + length;) {
+                struct inotify_event *event = (struct inotify_event*)p;
+                if (event->len && strcmp(event->name, source->name) == 0)
+                    matched = true;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (matched)
+            source->fd_callback(loop, source->fd, events, source->data);
+        break;
+    }
+    case SOURCE_USB_TIMER:
+        if (read(source->fd, &expirations, sizeof(expirations)) < 0)
+            break;
+        // fall through
+    case SOURCE_USB:
+        libusb_handle_events_timeout(NULL, &zero);
+        libgtlm_loop_usb_rearm(loop);
+        break;
+    }
+}
+
+
+int
+libgtlm_loop_run_once(libgtlm_loop *loop, int timeout)
+{
+    if (loop == NULL)
+        return -1;
+
+    struct epoll_event events[GTLM_LOOP_EVENTS];
+    int count = epoll_wait(loop->epoll, events, GTLM_LOOP_EVENTS, timeout);
+    loop->wakeups++;
+    loop->window_wakeups++;
+    if (count < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < count; i++) {
+        libgtlm_source *source = (libgtlm_source*)events[i].data.ptr;
+        if (!source->removed)
+            libgtlm_loop_dispatch(loop, source, events[i].events);
+    }
+    libgtlm_loop_reap(loop);
+    return count;
+}
+
+
+int
+libgtlm_loop_run(libgtlm_loop *loop)
+{
+    if (loop == NULL)
+        return -1;
+
+    loop->quit = false;
+    while (!loop->quit) {
+        if (libgtlm_loop_run_once(loop, -1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+void
+libgtlm_loop_quit(libgtlm_loop *loop)
+{
+    if (loop)
+        loop->quit = true;
+}
+
+
+uint64_t
+libgtlm_loop_get_wakeups(libgtlm_loop *loop)
+{
+    return loop ? loop->wakeups : 0;
+}
+
+
+double
+libgtlm_loop_get_wakeup_rate(libgtlm_loop *loop)
+{
+    if (loop == NULL)
+        return 0;
+
+    uint64_t now = libgtlm_time_ns();
+    uint64_t elapsed = now - loop->window_start;
+    if (elapsed >= 1000000000ULL) {
+        loop->wakeup_rate = loop->window_wakeups * 1e9 / elapsed;
+        loop->window_wakeups = 0;
+        loop->window_start = now;
+    }
+    return loop->wakeup_rate;
+}
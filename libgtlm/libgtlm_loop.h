@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_LOOP_H__
+#define __LIBGTLM_LOOP_H__
+
+#include <stdint.h>
+
+typedef struct libgtlm_loop libgtlm_loop;
+
+typedef void (*libgtlm_fd_callback)(libgtlm_loop *loop, int fd,
+    uint32_t events, void *data);
+typedef void (*libgtlm_timer_callback)(libgtlm_loop *loop, int timer,
+    void *data);
+typedef void (*libgtlm_signal_callback)(libgtlm_loop *loop, int signal,
+    void *data);
+
+// epoll based loop for long-running libgtlm users (Linux only). Timers are
+// timerfds and signals a signalfd, so the loop blocks indefinitely unless a
+// timer is armed or something happens; it never polls.
+libgtlm_loop* libgtlm_loop_new();
+void libgtlm_loop_free(libgtlm_loop *loop);
+
+// events are EPOLL* flags
+int libgtlm_loop_add_fd(libgtlm_loop *loop, int fd, uint32_t events,
+    libgtlm_fd_callback callback, void *data);
+void libgtlm_loop_remove_fd(libgtlm_loop *loop, int fd);
+
+// Returns a timer id (>= 0). Times are relative, in nanoseconds; an interval
+// of 0 makes a one-shot timer and an initial of 0 leaves it disarmed.
+int libgtlm_loop_add_timer(libgtlm_loop *loop, uint64_t initial,
+    uint64_t interval, libgtlm_timer_callback callback, void *data);
+int libgtlm_loop_set_timer(libgtlm_loop *loop, int timer, uint64_t initial,
+    uint64_t interval);
+void libgtlm_loop_remove_timer(libgtlm_loop *loop, int timer);
+
+// Blocks the signal for the calling thread and delivers it through the loop.
+int libgtlm_loop_add_signal(libgtlm_loop *loop, int signal,
+    libgtlm_signal_callback callback, void *data);
+
+// Calls back when the file is written, replaced or removed (e.g. ~/.gtlm).
+int libgtlm_loop_watch_file(libgtlm_loop *loop, const char *path,
+    libgtlm_fd_callback callback, void *data);
+
+// Lets the loop drive libusb: its pollfds are watched and events handled
+// as they arrive, which asynchronous transfers need.
+int libgtlm_loop_watch_usb(libgtlm_loop *loop);
+
+// run_once waits at most timeout ms (-1 = forever) and dispatches one batch.
+int libgtlm_loop_run_once(libgtlm_loop *loop, int timeout);
+int libgtlm_loop_run(libgtlm_loop *loop);
+void libgtlm_loop_quit(libgtlm_loop *loop);
+
+uint64_t libgtlm_loop_get_wakeups(libgtlm_loop *loop);
+// Average over the time since the previous call (at least one second).
+double libgtlm_loop_get_wakeup_rate(libgtlm_loop *loop);
+
+#endif // __LIBGTLM_LOOP_H__
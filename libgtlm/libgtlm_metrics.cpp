@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "libgtlm_metrics.h"
+
+#define GTLM_METRIC_BUFFER           16384          // bytes, grown as needed
+#define GTLM_METRIC_NAME             32
+
+typedef struct libgtlm_metric_source {
+    libgtlm_metric_type type;
+    int fd;
+    char name[GTLM_METRIC_NAME];
+    uint8_t zone;
+    double threshold;
+    bool on;
+    bool primed;
+    uint64_t counters[2];
+    uint64_t time;
+    double value;
+    uint32_t interval;
+    uint64_t due;
+} libgtlm_metric_source;
+
+struct libgtlm_metrics {
+    libgtlm_device *device;
+    libgtlm_metric_source sources[GTLM_MAX_METRICS];
+    int count;
+    uint8_t driven;
+    double hysteresis;
+    uint32_t min_interval;
+    uint32_t max_interval;
+    uint32_t interval;
+    uint8_t lit;
+    uint64_t read_errors;
+    char *buffer;
+    size_t buffer_size;
+};
+
+static const char *kMetricPaths[] = {
+    "/proc/stat",
+    "/proc/diskstats",
+    "/proc/net/dev",
+    "/sys/class/thermal/thermal_zone0/temp"
+};
+
+
+// Minimal in-place scanners; none of them allocate or copy.
+static const char*
+libgtlm_skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+
+static const char*
+libgtlm_parse_u64(const char *p, const char *end, uint64_t *value)
+{
+    p = libgtlm_skip_space(p, end);
+    uint64_t result = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        result = result * 10 + (*p++ - '0');
+    *value = result;
+    return p;
+}
+
+
+static const char*
+libgtlm_next_line(const char *p, const char *end)
+{
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+
+static bool
+libgtlm_has_prefix(const char *name, size_t length, const char *prefix)
+{
+    size_t prefixLength = strlen(prefix);
+    return length >= prefixLength && memcmp(name, prefix, prefixLength) == 0;
+}
+
+
+static bool
+libgtlm_name_matches(const libgtlm_metric_source *source, const char *name,
+    size_t length)
+{
+    return strlen(source->name) == length
+        && memcmp(source->name, name, length) == 0;
+}
+
+
+// Busy and total jiffies from the aggregate "cpu" line. Only the first
+// eight fields count: guest and guest_nice are already part of user and
+// nice.
+static bool
+libgtlm_parse_cpu(const char *p, const char *end, uint64_t *busy,
+    uint64_t *total)
+{
+    if (end - p < 4 || memcmp(p, "cpu ", 4) != 0)
+        return false;
+
+    p += 4;
+    *busy = *total = 0;
+    for (int i = 0; i < 8 && p < end && *p != '\n'; i++) {
+        uint64_t value;
+        p = libgtlm_parse_u64(p, end, &value);
+        *total += value;
+        if (i != 3 && i != 4)   // idle, iowait
+            *busy += value;
+    }
+    return *total != 0;
+}
+
+
+// Milliseconds spent doing I/O. Without a name, whole disks are summed:
+// partitions follow their disk and are recognised by its name prefix.
+// Device-mapper and md devices are left out, their I/O already shows on
+// the disks underneath.
+static bool
+libgtlm_parse_disk(const libgtlm_metric_source *source, const char *p,
+    const char *end, uint64_t *ticks)
+{
+    const char *disk = NULL;
+    size_t diskLength = 0;
+    bool found = false;
+
+    *ticks = 0;
+    for (; p < end; p = libgtlm_next_line(p, end)) {
+        uint64_t value;
+        p = libgtlm_parse_u64(p, end, &value);     // major
+        p = libgtlm_parse_u64(p, end, &value);     // minor
+        p = libgtlm_skip_space(p, end);
+        const char *name = p;
+        while (p < end && *p != ' ' && *p != '\n')
+            p++;
+        size_t length = p - name;
+        if (length == 0)
+            continue;
+
+        if (source->name[0]) {
+            if (!libgtlm_name_matches(source, name, length))
+                continue;
+        } else {
+            if (disk && length > diskLength
+                && memcmp(name, disk, diskLength) == 0)
+                continue;
+            disk = name;
+            diskLength = length;
+            if (libgtlm_has_prefix(name, length, "loop")
+                || libgtlm_has_prefix(name, length, "ram")
+                || libgtlm_has_prefix(name, length, "zram")
+                || libgtlm_has_prefix(name, length, "dm-")
+                || libgtlm_has_prefix(name, length, "md"))
+                continue;
+        }
+
+        for (int i = 0; i < 10; i++)
+            p = libgtlm_parse_u64(p, end, &value);
+        *ticks += value;
+        found = true;
+    }
+    return found;
+}
+
+
+// rx + tx bytes; the first two lines are headers
+static bool
+libgtlm_parse_net(const libgtlm_metric_source *source, const char *p,
+    const char *end, uint64_t *bytes)
+{
+    bool found = false;
+
+    *bytes = 0;
+    p = libgtlm_next_line(libgtlm_next_line(p, end), end);
+    for (; p < end; p = libgtlm_next_line(p, end)) {
+        p = libgtlm_skip_space(p, end);
+        const char *name = p;
+        while (p < end && *p != ':' && *p != '\n')
+            p++;
+        if (p == end || *p != ':')
+            continue;
+        size_t length = p - name;
+        p++;
+
+        if (source->name[0] ? !libgtlm_name_matches(source, name, length)
+            : length == 2 && memcmp(name, "lo", 2) == 0)
+            continue;
+
+        uint64_t value;
+        for (int i = 0; i < 9; i++) {
+            p = libgtlm_parse_u64(p, end, &value);
+            if (i == 0 || i == 8)
+                *bytes += value;
+        }
+        found = true;
+    }
+    return found;
+}
+
+
+// Reads the whole file. The buffer doubles whenever a read fills it and
+// keeps its size, so only the first samples of a large file allocate.
+static ssize_t
+libgtlm_metric_fill(libgtlm_metrics *metrics, int fd)
+{
+    size_t length = 0;
+    for (;;) {
+        if (length == metrics->buffer_size) {
+            char *buffer = (char*)realloc(metrics->buffer,
+                metrics->buffer_size * 2);
+            if (buffer == NULL)
+                return -1;
+            metrics->buffer = buffer;
+            metrics->buffer_size *= 2;
+        }
+
+        ssize_t result = pread(fd, metrics->buffer + length,
+            metrics->buffer_size - length, length);
+        if (result < 0)
+            return -1;
+        if (result == 0)
+            return length;
+        length += result;
+    }
+}
+
+
+static bool
+libgtlm_metric_read(libgtlm_metrics *metrics, libgtlm_metric_source *source,
+    uint64_t now)
+{
+    ssize_t length = libgtlm_metric_fill(metrics, source->fd);
+    // not a USB failure: kept out of the error ring and its counters
+    if (length <= 0) {
+        metrics->read_errors++;
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_WARN, "metrics: source %d unreadable",
+            (int)(source - metrics->sources));
+        return false;
+    }
+
+    const char *p = metrics->buffer;
+    const char *end = p + length;
+    uint64_t counters[2] = { 0, 0 };
+    bool parsed = false;
+
+    switch (source->type) {
+    case METRIC_CPU:
+        parsed = libgtlm_parse_cpu(p, end, &counters[0], &counters[1]);
+        break;
+    case METRIC_DISK:
+        parsed = libgtlm_parse_disk(source, p, end, &counters[0]);
+        break;
+    case METRIC_NET:
+        parsed = libgtlm_parse_net(source, p, end, &counters[0]);
+        break;
+    case METRIC_TEMP: {
+        bool negative = p < end && *p == '-';
+        libgtlm_parse_u64(negative ? p + 1 : p, end, &counters[0]);
+        source->value = (negative ? -1.0 : 1.0) * counters[0] / 1000.0;
+        return true;
+    }
+    }
+
+    if (!parsed)
+        return false;
+
+    if (source->primed && now > source->time) {
+        uint64_t delta = counters[0] - source->counters[0];
+        double elapsed = (now - source->time) / 1e9;
+        switch (source->type) {
+        case METRIC_CPU:
+            if (counters[1] > source->counters[1])
+                source->value = (double)delta
+                    / (counters[1] - source->counters[1]);
+            break;
+        case METRIC_DISK:
+            source->value = delta / (elapsed * 1000.0);
+            break;
+        default:
+            source->value = delta / elapsed;
+            break;
+        }
+    }
+
+    source->counters[0] = counters[0];
+    source->counters[1] = counters[1];
+    source->time = now;
+    source->primed = true;
+    return true;
+}
+
+
+libgtlm_metrics*
+libgtlm_metrics_new(libgtlm_device *device)
+{
+    if (device == NULL)
+        return NULL;
+
+    libgtlm_metrics *metrics = (libgtlm_metrics*)malloc(sizeof(*metrics));
+    if (metrics == NULL)
+        return NULL;
+
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->buffer = (char*)malloc(GTLM_METRIC_BUFFER);
+    if (metrics->buffer == NULL) {
+        free(metrics);
+        return NULL;
+    }
+    metrics->buffer_size = GTLM_METRIC_BUFFER;
+    metrics->device = device;
+    metrics->hysteresis = 0.1;
+    metrics->min_interval = 10;
+    metrics->max_interval = 1000;
+    metrics->interval = metrics->min_interval;
+    return metrics;
+}
+
+
+void
+libgtlm_metrics_free(libgtlm_metrics *metrics)
+{
+    if (metrics == NULL)
+        return;
+
+    for (int i = 0; i < metrics->count; i++)
+        close(metrics->sources[i].fd);
+    free(metrics->buffer);
+    free(metrics);
+}
+
+
+int
+libgtlm_metrics_add(libgtlm_metrics *metrics, libgtlm_metric_type type,
+    const char *path, const char *name, uint8_t zone, double threshold)
+{
+    if (metrics == NULL || metrics->count == GTLM_MAX_METRICS
+        || type > METRIC_TEMP || (zone & LEDS_ALL) == 0
+        || (name && strlen(name) >= GTLM_METRIC_NAME))
+        return -1;
+
+    int fd = open(path ? path : kMetricPaths[type], O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    libgtlm_metric_source *source = &metrics->sources[metrics->count];
+    memset(source, 0, sizeof(*source));
+    source->type = type;
+    source->fd = fd;
+    if (name)
+        strcpy(source->name, name);
+    source->zone = zone & LEDS_ALL;
+    source->threshold = threshold;
+    source->interval = metrics->min_interval;
+    metrics->driven |= source->zone;
+    libgtlm_metric_read(metrics, source, libgtlm_time_ns());
+    return metrics->count++;
+}
+
+
+void
+libgtlm_metrics_set_hysteresis(libgtlm_metrics *metrics, double hysteresis)
+{
+    if (metrics && hysteresis >= 0 && hysteresis < 1)
+        metrics->hysteresis = hysteresis;
+}
+
+
+void
+libgtlm_metrics_set_interval(libgtlm_metrics *metrics, uint32_t minimum,
+    uint32_t maximum)
+{
+    if (metrics == NULL || minimum == 0 || maximum < minimum)
+        return;
+
+    metrics->min_interval = minimum;
+    metrics->max_interval = maximum;
+    metrics->interval = minimum;
+    for (int i = 0; i < metrics->count; i++) {
+        metrics->sources[i].interval = minimum;
+        metrics->sources[i].due = 0;
+    }
+}
+
+
+uint32_t
+libgtlm_metrics_get_interval(libgtlm_metrics *metrics)
+{
+    return metrics ? metrics->interval : 0;
+}
+
+
+// Only sources whose own interval has run out are read, so a quiet source
+// (a temperature far from its threshold, say) backs off to max_interval
+// while a busy one keeps sampling at min_interval.
+int
+libgtlm_metrics_sample(libgtlm_metrics *metrics)
+{
+    if (metrics == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    uint64_t now = libgtlm_time_ns();
+    uint64_t next = now + (uint64_t)metrics->max_interval * 1000000;
+    uint8_t lit = 0;
+    for (int i = 0; i < metrics->count; i++) {
+        libgtlm_metric_source *source = &metrics->sources[i];
+        if (now >= source->due && libgtlm_metric_read(metrics, source, now)) {
+            double low = source->threshold * (1.0 - metrics->hysteresis);
+            double high = source->threshold * (1.0 + metrics->hysteresis);
+            bool on = source->value >= source->threshold ? true
+                : source->value < low ? false : source->on;
+            if (on != source->on
+                || (source->value >= low && source->value < high))
+                source->interval = source->interval / 2 > metrics->min_interval
+                    ? source->interval / 2 : metrics->min_interval;
+            else
+                source->interval = source->interval * 2 < metrics->max_interval
+                    ? source->interval * 2 : metrics->max_interval;
+            source->on = on;
+            source->due = now + (uint64_t)source->interval * 1000000;
+        }
+
+        if (source->due < next)
+            next = source->due;
+        if (source->on)
+            lit |= source->zone;
+    }
+    metrics->interval = next > now ? (uint32_t)((next - now) / 1000000) : 0;
+    if (metrics->interval < metrics->min_interval)
+        metrics->interval = metrics->min_interval;
+
+    libgtlm_device *device = metrics->device;
+    uint8_t status = (device->led_status & ~metrics->driven) | lit;
+    if (lit == metrics->lit && status == device->led_status) {
+        device->sync_stats.skipped++;
+        return LIBUSB_SUCCESS;
+    }
+
+    // a failed sync leaves both as they were, so the next sample retries
+    uint8_t previous = device->led_status;
+    device->led_status = status;
+    int result = libgtlm_sync(device);
+    if (result < 0)
+        device->led_status = previous;
+    else
+        metrics->lit = lit;
+    return result;
+}
+
+
+double
+libgtlm_metrics_get_value(libgtlm_metrics *metrics, int source)
+{
+    if (metrics == NULL || source < 0 || source >= metrics->count)
+        return 0;
+
+    return metrics->sources[source].value;
+}
+
+
+uint64_t
+libgtlm_metrics_get_read_errors(libgtlm_metrics *metrics)
+{
+    return metrics ? metrics->read_errors : 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_METRICS_H__
+#define __LIBGTLM_METRICS_H__
+
+#include "libgtlm.h"
+
+#define GTLM_MAX_METRICS             8
+
+enum libgtlm_metric_type {
+    METRIC_CPU      = 0,    // busy fraction, /proc/stat
+    METRIC_DISK,            // busy fraction (io_ticks), /proc/diskstats
+    METRIC_NET,             // rx + tx bytes per second, /proc/net/dev
+    METRIC_TEMP             // degrees Celsius, /sys/class/thermal/thermal_zone0/temp
+};
+
+typedef struct libgtlm_metrics libgtlm_metrics;
+
+// Host metrics driving zones (Linux only). Each source lights its zone while
+// its value is at or above the threshold and turns it off again below
+// threshold * (1 - hysteresis). Files stay open and are re-read with pread
+// into a buffer that only grows while a file outgrows it, so sampling
+// neither opens files nor, once settled, allocates.
+libgtlm_metrics* libgtlm_metrics_new(libgtlm_device *device);
+void libgtlm_metrics_free(libgtlm_metrics *metrics);
+
+// path overrides the default file (fixtures, another thermal zone). name
+// picks one disk or interface; NULL sums all of them except loop/ram,
+// device-mapper and md devices and lo. Returns the source index or -1.
+int libgtlm_metrics_add(libgtlm_metrics *metrics, libgtlm_metric_type type,
+    const char *path, const char *name, uint8_t zone, double threshold);
+void libgtlm_metrics_set_hysteresis(libgtlm_metrics *metrics, double hysteresis);
+
+// Each source's sampling interval (ms) adapts between these: it halves
+// while its zone flips or its value is within the hysteresis band of the
+// threshold, and doubles while it is stable. get_interval gives the time
+// until the next source is due, for arming a timer.
+void libgtlm_metrics_set_interval(libgtlm_metrics *metrics, uint32_t minimum,
+    uint32_t maximum);
+uint32_t libgtlm_metrics_get_interval(libgtlm_metrics *metrics);
+
+// Samples the sources that are due and syncs the device only if the zone
+// mask changed.
+int libgtlm_metrics_sample(libgtlm_metrics *metrics);
+double libgtlm_metrics_get_value(libgtlm_metrics *metrics, int source);
+// Failed reads of the metric files. These are not libusb errors and are
+// not reported to the error ring.
+uint64_t libgtlm_metrics_get_read_errors(libgtlm_metrics *metrics);
+
+#endif // __LIBGTLM_METRICS_H__
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include "libgtlm_monitor.h"
+
+// readers give up after this many torn copies in a row
+#define GTLM_MONITOR_RETRIES         1000
+
+
+struct libgtlm_monitor {
+    libgtlm_monitor_segment *segment;
+    char *name;                 // set for the owner, which unlinks on close
+    ino_t inode;                // of the owner's segment
+    uint64_t interval;          // ns
+    uint64_t last;
+    uint64_t published;
+    bool dirty;                 // a publish was skipped inside the window
+    int timer_fd;               // fires when it ends, once asked for
+    libgtlm_pacer *pacer;
+};
+
+
+static libgtlm_monitor*
+libgtlm_monitor_map(int fd, int protection)
+{
+    void *memory = mmap(NULL, sizeof(libgtlm_monitor_segment), protection,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return NULL;
+
+    libgtlm_monitor *monitor = (libgtlm_monitor*)malloc(sizeof(*monitor));
+    if (monitor == NULL) {
+        munmap(memory, sizeof(libgtlm_monitor_segment));
+        return NULL;
+    }
+
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->segment = (libgtlm_monitor_segment*)memory;
+    monitor->timer_fd = -1;
+    return monitor;
+}
+
+
+// An existing segment may be taken over if it cannot be read, was never
+// published to, or the pid of its last snapshot is gone.
+static bool
+libgtlm_monitor_stale(const char *name)
+{
+    errno = 0;
+    libgtlm_monitor *monitor = libgtlm_monitor_open(name);
+    if (monitor == NULL)
+        return errno != EACCES;
+
+    libgtlm_monitor_snapshot snapshot;
+    bool stale;
+    if (libgtlm_monitor_read(monitor, &snapshot))
+        stale = kill(snapshot.pid, 0) < 0 && errno == ESRCH;
+    else
+        stale = monitor->segment->lock.load() == 0;
+    libgtlm_monitor_close(monitor);
+    return stale;
+}
+
+
+libgtlm_monitor*
+libgtlm_monitor_create(const char *name, int mode, uint32_t interval)
+{
+    if (name == NULL)
+        name = GTLM_MONITOR_NAME;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (fd < 0 && errno == EEXIST) {
+        if (!libgtlm_monitor_stale(name)) {
+            errno = EEXIST;
+            return NULL;
+        }
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_WARN,
+            "monitor: replacing stale segment %s", name);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    }
+    if (fd < 0)
+        return NULL;
+
+    // the umask applies to shm_open; readers may run as other users
+    struct stat info;
+    if (fchmod(fd, mode) < 0
+        || ftruncate(fd, sizeof(libgtlm_monitor_segment)) < 0
+        || fstat(fd, &info) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    libgtlm_monitor *monitor = libgtlm_monitor_map(fd,
+        PROT_READ | PROT_WRITE);
+    if (monitor == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    libgtlm_monitor_segment *segment =
+        new (monitor->segment) libgtlm_monitor_segment();
+    segment->magic = GTLM_MONITOR_MAGIC;
+    segment->version = GTLM_MONITOR_VERSION;
+    segment->size = sizeof(libgtlm_monitor_snapshot);
+    monitor->name = strdup(name);
+    monitor->inode = info.st_ino;
+    monitor->interval = (uint64_t)interval * 1000000;
+    return monitor;
+}
+
+
+libgtlm_monitor*
+libgtlm_monitor_open(const char *name)
+{
+    if (name == NULL)
+        name = GTLM_MONITOR_NAME;
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0
+        || info.st_size < (off_t)sizeof(libgtlm_monitor_segment)) {
+        close(fd);
+        return NULL;
+    }
+
+    libgtlm_monitor *monitor = libgtlm_monitor_map(fd, PROT_READ);
+    if (monitor && (monitor->segment->magic != GTLM_MONITOR_MAGIC
+            || monitor->segment->version != GTLM_MONITOR_VERSION
+            || monitor->segment->size != sizeof(libgtlm_monitor_snapshot))) {
+        libgtlm_monitor_close(monitor);
+        return NULL;
+    }
+    return monitor;
+}
+
+
+void
+libgtlm_monitor_close(libgtlm_monitor *monitor)
+{
+    if (monitor == NULL)
+        return;
+
+    if (monitor->timer_fd >= 0)
+        close(monitor->timer_fd);
+    munmap(monitor->segment, sizeof(libgtlm_monitor_segment));
+    if (monitor->name) {
+        // leave the name alone if another owner has taken it over since
+        int fd = shm_open(monitor->name, O_RDONLY | O_CLOEXEC, 0);
+        struct stat info;
+        if (fd >= 0) {
+            if (fstat(fd, &info) == 0 && info.st_ino == monitor->inode)
+                shm_unlink(monitor->name);
+            close(fd);
+        }
+        free(monitor->name);
+    }
+    free(monitor);
+}
+
+
+void
+libgtlm_monitor_attach(libgtlm_monitor *monitor, libgtlm_device *device)
+{
+    if (device == NULL)
+        return;
+
+    device->monitor = monitor;
+    // readers see the current state even if the device stays idle
+    libgtlm_monitor_publish(monitor, device);
+}
+
+
+void
+libgtlm_monitor_set_pacer(libgtlm_monitor *monitor, libgtlm_pacer *pacer)
+{
+    if (monitor)
+        monitor->pacer = pacer;
+}
+
+
+void
+libgtlm_monitor_collect(libgtlm_device *device, libgtlm_pacer *pacer,
+    libgtlm_monitor_snapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->timestamp = libgtlm_time_ns();
+    snapshot->pid = getpid();
+    snapshot->led_status = device->led_status;
+    snapshot->led_mode = device->led_mode;
+    snapshot->enabled = device->enabled;
+    snapshot->sync = device->sync_stats;
+    memcpy(snapshot->latency, device->latency, sizeof(snapshot->latency));
+    libgtlm_get_reconnect_stats(device, &snapshot->reconnect);
+    for (int i = 0; i < GTLM_ERROR_CODES; i++)
+        snapshot->errors[i] = libgtlm_error_count(-i);
+    snapshot->dropped_errors = libgtlm_dropped_errors();
+    snapshot->has_pacer = pacer != NULL;
+    if (pacer)
+        libgtlm_pacer_get_stats(pacer, &snapshot->pacer);
+}
+
+
+bool
+libgtlm_monitor_publish(libgtlm_monitor *monitor, libgtlm_device *device)
+{
+    if (monitor == NULL || device == NULL || monitor->name == NULL)
+        return false;
+
+    uint64_t now = libgtlm_time_ns();
+    if (monitor->last != 0 && now - monitor->last < monitor->interval) {
+        // the timer publishes it when the window ends
+        if (!monitor->dirty && monitor->timer_fd >= 0) {
+            uint64_t left = monitor->interval - (now - monitor->last);
+            struct itimerspec spec;
+            memset(&spec, 0, sizeof(spec));
+            spec.it_value.tv_sec = left / 1000000000ULL;
+            spec.it_value.tv_nsec = left % 1000000000ULL;
+            timerfd_settime(monitor->timer_fd, 0, &spec, NULL);
+        }
+        monitor->dirty = true;
+        return false;
+    }
+    monitor->last = now;
+    monitor->dirty = false;
+
+    libgtlm_monitor_snapshot snapshot;
+    libgtlm_monitor_collect(device, monitor->pacer, &snapshot);
+    snapshot.published = ++monitor->published;
+    uint64_t words[GTLM_MONITOR_WORDS] = { 0 };
+    memcpy(words, &snapshot, sizeof(snapshot));
+
+    // single writer: no need to take the lock, only to mark it odd
+    libgtlm_monitor_segment *segment = monitor->segment;
+    uint32_t lock = segment->lock.load(std::memory_order_relaxed);
+    segment->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < GTLM_MONITOR_WORDS; i++)
+        segment->words[i].store(words[i], std::memory_order_relaxed);
+    segment->lock.store(lock + 2, std::memory_order_release);
+    return true;
+}
+
+
+int
+libgtlm_monitor_get_timerfd(libgtlm_monitor *monitor)
+{
+    if (monitor == NULL || monitor->name == NULL)
+        return -1;
+
+    if (monitor->timer_fd < 0)
+        monitor->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    return monitor->timer_fd;
+}
+
+
+bool
+libgtlm_monitor_flush(libgtlm_monitor *monitor, libgtlm_device *device)
+{
+    if (monitor == NULL || !monitor->dirty)
+        return false;
+
+    monitor->last = 0;
+    return libgtlm_monitor_publish(monitor, device);
+}
+
+
+bool
+libgtlm_monitor_read(libgtlm_monitor *monitor,
+    libgtlm_monitor_snapshot *snapshot)
+{
+    if (monitor == NULL || snapshot == NULL)
+        return false;
+
+    libgtlm_monitor_segment *segment = monitor->segment;
+    uint64_t words[GTLM_MONITOR_WORDS];
+    for (int attempt = 0; attempt < GTLM_MONITOR_RETRIES; attempt++) {
+        uint32_t lock = segment->lock.load(std::memory_order_acquire);
+        if (lock & 1)
+            continue;
+        for (size_t i = 0; i < GTLM_MONITOR_WORDS; i++)
+            words[i] = segment->words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->lock.load(std::memory_order_relaxed) != lock)
+            continue;
+        if (lock == 0)
+            return false;
+
+        memcpy(snapshot, words, sizeof(*snapshot));
+        return true;
+    }
+    return false;
+}
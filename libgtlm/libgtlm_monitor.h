@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_MONITOR_H__
+#define __LIBGTLM_MONITOR_H__
+
+#include <atomic>
+#include "libgtlm.h"
+#include "libgtlm_pacer.h"
+
+#define GTLM_MONITOR_NAME            "/gtlm-monitor"
+#define GTLM_MONITOR_MAGIC           0x4e4f4d47     // "GMON"
+#define GTLM_MONITOR_VERSION         1
+#define GTLM_MONITOR_INTERVAL        250            // ms between snapshots
+
+// Counters of one device-owning process at one point in time.
+typedef struct libgtlm_monitor_snapshot {
+    uint64_t timestamp;         // libgtlm_time_ns() of the owner
+    uint64_t published;         // snapshots taken so far
+    int32_t pid;
+    uint8_t led_status;
+    uint8_t led_mode;
+    bool enabled;
+    bool has_pacer;
+    libgtlm_sync_stats sync;
+    libgtlm_latency latency[CMD_COUNT];
+    libgtlm_reconnect_stats reconnect;
+    uint64_t errors[GTLM_ERROR_CODES];  // by -libusb_error
+    uint64_t dropped_errors;
+    libgtlm_pacer_stats pacer;
+} libgtlm_monitor_snapshot;
+
+#define GTLM_MONITOR_WORDS \
+    ((sizeof(libgtlm_monitor_snapshot) + 7) / 8)
+
+// Layout of the POSIX shared memory segment. The snapshot is copied in and
+// out word by word under a seqlock: odd while the owner writes, readers
+// retry until both sides of their copy see the same even value.
+typedef struct libgtlm_monitor_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // sizeof(libgtlm_monitor_snapshot)
+    alignas(64) std::atomic<uint32_t> lock;
+    std::atomic<uint64_t> words[GTLM_MONITOR_WORDS];
+} libgtlm_monitor_segment;
+
+typedef struct libgtlm_monitor libgtlm_monitor;
+
+// Live counters for gtlm-top and similar tools (Linux only). The owning
+// process creates the segment and attaches the device; from then on the
+// device's own syncs publish a snapshot at most every interval ms, so
+// nothing extra runs and the readers, which only map the segment, never
+// touch the device or its thread. Creating fails with EEXIST while the
+// process of the last snapshot is alive; a segment left behind by a dead
+// owner is taken over.
+libgtlm_monitor* libgtlm_monitor_create(const char *name, int mode,
+    uint32_t interval);
+libgtlm_monitor* libgtlm_monitor_open(const char *name);
+void libgtlm_monitor_close(libgtlm_monitor *monitor);
+
+// owner: publishes once right away, then from libgtlm_sync and
+// libgtlm_send_led_status; pass NULL to detach. The pacer must outlive the
+// monitor.
+void libgtlm_monitor_attach(libgtlm_monitor *monitor, libgtlm_device *device);
+void libgtlm_monitor_set_pacer(libgtlm_monitor *monitor, libgtlm_pacer *pacer);
+// owner: until interval ms have passed only compares a timestamp. True
+// when a snapshot was published.
+bool libgtlm_monitor_publish(libgtlm_monitor *monitor, libgtlm_device *device);
+// owner: a timerfd, for use with libgtlm_loop, that becomes readable when
+// the window of a skipped publish ends; libgtlm_monitor_flush then
+// publishes the state the readers are missing.
+int libgtlm_monitor_get_timerfd(libgtlm_monitor *monitor);
+bool libgtlm_monitor_flush(libgtlm_monitor *monitor, libgtlm_device *device);
+// Fills a snapshot from the thread that owns the device; shared with the
+// Prometheus exporter.
+void libgtlm_monitor_collect(libgtlm_device *device, libgtlm_pacer *pacer,
+    libgtlm_monitor_snapshot *snapshot);
+
+// readers: false until the owner published once.
+bool libgtlm_monitor_read(libgtlm_monitor *monitor,
+    libgtlm_monitor_snapshot *snapshot);
+
+#endif // __LIBGTLM_MONITOR_H__
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "libgtlm_pacer.h"
+
+
+static const char *kPriorityNames[PRIORITY_COUNT] = {
+    "interactive", "alert", "bulk"
+};
+
+typedef struct libgtlm_pacer_slot {
+    bool pending;
+    libgtlm_frame frame;
+    uint64_t submitted;         // libgtlm_time_ns()
+} libgtlm_pacer_slot;
+
+struct libgtlm_pacer {
+    libgtlm_device *device;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running;
+    libgtlm_pacer_slot slots[PRIORITY_COUNT];
+    libgtlm_pacer_stats stats;
+    uint64_t min_interval;
+    uint64_t sync_time;
+    std::atomic<uint32_t> rate;
+};
+
+
+// Deadlines are libgtlm_time_ns() values, which need not be steady_clock
+// time (libgtlm_set_clock); wait for what is left of them instead.
+static std::chrono::nanoseconds
+libgtlm_pacer_remaining(uint64_t deadline)
+{
+    uint64_t now = libgtlm_time_ns();
+    return std::chrono::nanoseconds(deadline > now ? deadline - now : 0);
+}
+
+
+// Expected cost of one frame. Confirmed syncs are two OUT/IN pairs whose
+// round trips the device already tracks; add one mean deviation each as
+// headroom. Other sync modes fall back to the measured sync duration.
+static uint64_t
+libgtlm_pacer_frame_cost(libgtlm_pacer *pacer)
+{
+    libgtlm_device *device = pacer->device;
+    const libgtlm_rtt *status = &device->rtt[CMD_SET_LED_STATUS];
+    const libgtlm_rtt *mode = &device->rtt[CMD_SET_LED_MODE];
+    if (device->sync_mode == SYNC_CONFIRMED && status->samples != 0
+        && mode->samples != 0)
+        return status->srtt + status->rttvar + mode->srtt + mode->rttvar;
+
+    return pacer->sync_time;
+}
+
+
+// Highest class with a frame waiting, or PRIORITY_COUNT if none.
+static int
+libgtlm_pacer_next(libgtlm_pacer *pacer)
+{
+    int priority = 0;
+    while (priority < PRIORITY_COUNT && !pacer->slots[priority].pending)
+        priority++;
+    return priority;
+}
+
+
+static void
+libgtlm_pacer_thread(libgtlm_pacer *pacer)
+{
+    libgtlm_device *device = pacer->device;
+    uint64_t next = 0;
+    libgtlm_trace_thread_name("pacer");
+
+    std::unique_lock<std::mutex> lock(pacer->lock);
+    for (;;) {
+        pacer->wake.wait(lock, [pacer] {
+            return libgtlm_pacer_next(pacer) < PRIORITY_COUNT
+                || !pacer->running; });
+        int priority = libgtlm_pacer_next(pacer);
+        if (priority == PRIORITY_COUNT)
+            break;
+
+        // bulk frames submitted while we wait here replace the pending one;
+        // anything more urgent ends the wait
+        if (priority == PRIORITY_BULK && pacer->running) {
+            pacer->wake.wait_for(lock, libgtlm_pacer_remaining(next),
+                [pacer] { return !pacer->running
+                    || libgtlm_pacer_next(pacer) < PRIORITY_BULK; });
+            priority = libgtlm_pacer_next(pacer);
+        }
+
+        libgtlm_pacer_slot *slot = &pacer->slots[priority];
+        libgtlm_frame frame = slot->frame;
+        slot->pending = false;
+        uint64_t dispatched = libgtlm_time_ns();
+        uint64_t queued = dispatched - slot->submitted;
+        libgtlm_latency_add(&pacer->stats.classes[priority].queued, queued);
+        if (libgtlm_trace_enabled())
+            libgtlm_trace_span("queue", kPriorityNames[priority],
+                slot->submitted, dispatched);
+        GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_TRACE,
+            "pacer: %s frame queued for %llu ns", kPriorityNames[priority],
+            (unsigned long long)queued);
+        lock.unlock();
+
+        uint64_t start = libgtlm_time_ns();
+        device->led_status = frame.led_status;
+        libgtlm_set_led_mode(device, (libgtlm_led_mode)frame.led_mode,
+            frame.enabled);
+        libgtlm_sync(device);
+        uint64_t elapsed = libgtlm_time_ns() - start;
+        if (libgtlm_trace_enabled())
+            libgtlm_trace_span("frame", "pacer", start, start + elapsed);
+        pacer->sync_time = pacer->sync_time == 0 ? elapsed
+            : (7 * pacer->sync_time + elapsed) / 8;
+
+        uint64_t interval = libgtlm_pacer_frame_cost(pacer);
+        if (interval < pacer->min_interval)
+            interval = pacer->min_interval;
+        next = start + interval;
+        pacer->rate.store((uint32_t)(1000000000ULL / interval),
+            std::memory_order_relaxed);
+        GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_TRACE,
+            "pacer: frame sent in %llu ns, next in %llu ns",
+            (unsigned long long)elapsed, (unsigned long long)interval);
+
+        lock.lock();
+        pacer->stats.sent++;
+        pacer->stats.classes[priority].sent++;
+    }
+}
+
+
+libgtlm_pacer*
+libgtlm_pacer_start(libgtlm_device *device, uint32_t maxRate)
+{
+    if (device == NULL || maxRate == 0)
+        return NULL;
+
+    libgtlm_pacer *pacer = new libgtlm_pacer;
+    pacer->device = device;
+    pacer->running = true;
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+        pacer->slots[i] = libgtlm_pacer_slot();
+    pacer->stats = libgtlm_pacer_stats();
+    // rates above 1 GHz would round the interval down to nothing
+    pacer->min_interval = maxRate < 1000000000 ? 1000000000ULL / maxRate : 1;
+    pacer->sync_time = 0;
+    pacer->rate = maxRate;
+    pacer->thread = std::thread(libgtlm_pacer_thread, pacer);
+    return pacer;
+}
+
+
+// The last submitted frame is still sent before the thread exits.
+void
+libgtlm_pacer_stop(libgtlm_pacer *pacer)
+{
+    if (pacer == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pacer->lock);
+        pacer->running = false;
+    }
+    pacer->wake.notify_one();
+    pacer->thread.join();
+    delete pacer;
+}
+
+
+void
+libgtlm_pacer_submit(libgtlm_pacer *pacer, const libgtlm_frame *frame)
+{
+    libgtlm_pacer_submit_priority(pacer, frame, PRIORITY_BULK);
+}
+
+
+// Frames carry the whole device state, so a pending frame of the same or a
+// lower class is stale once a newer one arrives. Pending frames of higher
+// classes are older and still go out first.
+void
+libgtlm_pacer_submit_priority(libgtlm_pacer *pacer,
+    const libgtlm_frame *frame, libgtlm_priority priority)
+{
+    if (pacer == NULL || frame == NULL || priority >= PRIORITY_COUNT)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pacer->lock);
+        for (int i = priority; i < PRIORITY_COUNT; i++) {
+            if (pacer->slots[i].pending) {
+                pacer->slots[i].pending = false;
+                pacer->stats.dropped++;
+                pacer->stats.classes[i].dropped++;
+                GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_TRACE,
+                    "pacer: %s frame dropped", kPriorityNames[i]);
+            }
+        }
+        libgtlm_pacer_slot *slot = &pacer->slots[priority];
+        slot->frame = *frame;
+        slot->pending = true;
+        slot->submitted = libgtlm_time_ns();
+        pacer->stats.submitted++;
+        pacer->stats.classes[priority].submitted++;
+    }
+    pacer->wake.notify_one();
+}
+
+
+uint32_t
+libgtlm_pacer_get_rate(libgtlm_pacer *pacer)
+{
+    return pacer ? pacer->rate.load(std::memory_order_relaxed) : 0;
+}
+
+
+void
+libgtlm_pacer_get_stats(libgtlm_pacer *pacer, libgtlm_pacer_stats *stats)
+{
+    if (pacer == NULL || stats == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(pacer->lock);
+    *stats = pacer->stats;
+}
+
+
+const char*
+libgtlm_priority_name(libgtlm_priority priority)
+{
+    return priority < PRIORITY_COUNT ? kPriorityNames[priority] : NULL;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_PACER_H__
+#define __LIBGTLM_PACER_H__
+
+#include "libgtlm.h"
+
+typedef struct libgtlm_pacer libgtlm_pacer;
+
+// Highest first. Interactive and alert frames skip the pacing wait and cut
+// a pending bulk frame's wait short; only a sync already in flight can
+// delay them.
+typedef enum libgtlm_priority {
+    PRIORITY_INTERACTIVE = 0,   // user commands: CLI, hotkeys
+    PRIORITY_ALERT,             // notifications
+    PRIORITY_BULK,              // animation frames
+    PRIORITY_COUNT
+} libgtlm_priority;
+
+typedef struct libgtlm_pacer_class_stats {
+    uint64_t submitted;
+    uint64_t sent;
+    uint64_t dropped;
+    libgtlm_latency queued;     // submit to hand-off to the device
+} libgtlm_pacer_class_stats;
+
+typedef struct libgtlm_pacer_stats {
+    uint64_t submitted;
+    uint64_t sent;
+    uint64_t dropped;           // superseded before they were sent
+    libgtlm_pacer_class_stats classes[PRIORITY_COUNT];
+} libgtlm_pacer_stats;
+
+// Decouples producers from the controller. Submitting never blocks: only
+// the newest frame of each class is kept, and a pacing thread syncs bulk
+// frames no faster than the controller's measured round trips allow (and
+// never above maxRate frames per second), so latency stays at one frame
+// instead of growing with a backlog. A frame also supersedes pending frames
+// of lower classes, so frames always reach the device in submission order
+// and the last one submitted wins. While running, the pacer thread owns the
+// device.
+libgtlm_pacer* libgtlm_pacer_start(libgtlm_device *device, uint32_t maxRate);
+void libgtlm_pacer_stop(libgtlm_pacer *pacer);
+// Same as libgtlm_pacer_submit_priority with PRIORITY_BULK.
+void libgtlm_pacer_submit(libgtlm_pacer *pacer, const libgtlm_frame *frame);
+void libgtlm_pacer_submit_priority(libgtlm_pacer *pacer,
+    const libgtlm_frame *frame, libgtlm_priority priority);
+uint32_t libgtlm_pacer_get_rate(libgtlm_pacer *pacer);
+void libgtlm_pacer_get_stats(libgtlm_pacer *pacer, libgtlm_pacer_stats *stats);
+const char* libgtlm_priority_name(libgtlm_priority priority);
+
+#endif // __LIBGTLM_PACER_H__
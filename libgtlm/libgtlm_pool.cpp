@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <string.h>
+#include "libgtlm.h"
+
+// libusb_dev_mem_alloc() appeared in libusb 1.0.21
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define GTLM_HAVE_DEV_MEM
+#endif
+
+#if defined(LIBUSB_API_VERSION)
+#define libgtlm_handle_events(completed) \
+    libusb_handle_events_completed(NULL, completed)
+#else
+#define libgtlm_handle_events(completed) \
+    libusb_handle_events_check(NULL, completed)
+#endif
+
+
+static void LIBUSB_CALL
+libgtlm_pool_callback(libusb_transfer *transfer)
+{
+    *(int*)transfer->user_data = 1;
+}
+
+
+static int
+libgtlm_pool_fill(libgtlm_transfer_slot *slot, libusb_device_handle *handle,
+    unsigned char *buffer, uint8_t requestType, uint8_t request)
+{
+    slot->transfer = libusb_alloc_transfer(0);
+    if (slot->transfer == NULL)
+        return LIBUSB_ERROR_NO_MEM;
+
+    memset(buffer, 0x00, GTLM_SLOT_SIZE);
+    libusb_fill_control_setup(buffer, requestType, request, GTLM_CONFIG_VALUE,
+        GTLM_CONFIG_INDEX, GTLM_PACKET_SIZE);
+    libusb_fill_control_transfer(slot->transfer, handle, buffer,
+        libgtlm_pool_callback, &slot->completed, 0x00);
+    return 0;
+}
+
+
+static int
+libgtlm_pool_transport(libgtlm_transport *transport, bool readBack)
+{
+    libgtlm_transfer_pool *pool = (libgtlm_transfer_pool*)transport;
+    return readBack ? libgtlm_pool_transfer(pool) : libgtlm_pool_send(pool);
+}
+
+
+int
+libgtlm_pool_init(libgtlm_transfer_pool *pool, libusb_device_handle *handle)
+{
+    memset(pool, 0, sizeof(*pool));
+
+#ifdef GTLM_HAVE_DEV_MEM
+    pool->memory = libusb_dev_mem_alloc(handle, 2 * GTLM_SLOT_SIZE);
+    pool->dev_mem = pool->memory != NULL;
+#endif
+    if (pool->memory == NULL)
+        pool->memory = (unsigned char*)malloc(2 * GTLM_SLOT_SIZE);
+    if (pool->memory == NULL)
+        return LIBUSB_ERROR_NO_MEM;
+
+    int result = libgtlm_pool_fill(&pool->out, handle, pool->memory,
+        GTLM_CONFIG_REQUEST_TYPE_OUT, LIBUSB_REQUEST_SET_CONFIGURATION);
+    if (result == 0)
+        result = libgtlm_pool_fill(&pool->in, handle,
+            pool->memory + GTLM_SLOT_SIZE, GTLM_CONFIG_REQUEST_TYPE_IN,
+            LIBUSB_REQUEST_CLEAR_FEATURE);
+    if (result < 0) {
+        libgtlm_pool_free(pool, handle);
+        return result;
+    }
+
+    pool->transport.request =
+        (libgtlm_packet*)libusb_control_transfer_get_data(pool->out.transfer);
+    pool->transport.reply =
+        (const libgtlm_packet*)libusb_control_transfer_get_data(pool->in.transfer);
+    pool->transport.transfer = libgtlm_pool_transport;
+
+    return result;
+}
+
+
+void
+libgtlm_pool_free(libgtlm_transfer_pool *pool, libusb_device_handle *handle)
+{
+    libusb_free_transfer(pool->out.transfer);
+    libusb_free_transfer(pool->in.transfer);
+#ifdef GTLM_HAVE_DEV_MEM
+    if (pool->dev_mem)
+        libusb_dev_mem_free(handle, pool->memory, 2 * GTLM_SLOT_SIZE);
+    else
+#endif
+        free(pool->memory);
+    (void)handle;
+    memset(pool, 0, sizeof(*pool));
+}
+
+
+// Submits a pre-built transfer and waits for it, the same way
+// libusb_control_transfer() does but without allocating anything.
+static int
+libgtlm_pool_submit(libgtlm_transfer_slot *slot)
+{
+    slot->completed = 0;
+    int result = libusb_submit_transfer(slot->transfer);
+    if (result < 0)
+        return result;
+
+    while (!slot->completed) {
+        result = libgtlm_handle_events(&slot->completed);
+        if (result < 0) {
+            if (result == LIBUSB_ERROR_INTERRUPTED)
+                continue;
+            libusb_cancel_transfer(slot->transfer);
+            while (!slot->completed)
+                if (libgtlm_handle_events(&slot->completed) < 0)
+                    break;
+            return result;
+        }
+    }
+
+    switch (slot->transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        return slot->transfer->actual_length;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+        return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+        return LIBUSB_ERROR_OVERFLOW;
+    default:
+        return LIBUSB_ERROR_IO;
+    }
+}
+
+
+int
+libgtlm_pool_transfer(libgtlm_transfer_pool *pool)
+{
+    int result = libgtlm_pool_submit(&pool->out);
+    if (result < 0)
+        return result;
+
+    return libgtlm_pool_submit(&pool->in);
+}
+
+
+// OUT only; the controller's reply is left unread.
+int
+libgtlm_pool_send(libgtlm_transfer_pool *pool)
+{
+    return libgtlm_pool_submit(&pool->out);
+}
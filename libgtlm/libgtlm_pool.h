@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_POOL_H__
+#define __LIBGTLM_POOL_H__
+
+#include "libusb.h"
+#include "libgtlm_protocol.h"
+#include "libgtlm_transport.h"
+
+#define GTLM_SLOT_SIZE               (LIBUSB_CONTROL_SETUP_SIZE + GTLM_PACKET_SIZE)
+
+// One pre-built control transfer. The setup packet is written once when the
+// pool is created, so a request only has to store its 8 payload bytes.
+typedef struct libgtlm_transfer_slot {
+    libusb_transfer *transfer;
+    int completed;
+} libgtlm_transfer_slot;
+
+// Per-device transfer objects and buffers, allocated once at init. Buffers
+// come from libusb_dev_mem_alloc where the backend supports it (usbfs maps
+// them straight into the kernel URB) and from malloc otherwise. The pool is
+// the device's default transport; its request and reply point straight into
+// the OUT and IN transfer buffers.
+typedef struct libgtlm_transfer_pool {
+    libgtlm_transport transport;
+    libgtlm_transfer_slot out;
+    libgtlm_transfer_slot in;
+    unsigned char *memory;
+    bool dev_mem;
+} libgtlm_transfer_pool;
+
+
+int libgtlm_pool_init(libgtlm_transfer_pool *pool, libusb_device_handle *handle);
+void libgtlm_pool_free(libgtlm_transfer_pool *pool, libusb_device_handle *handle);
+int libgtlm_pool_transfer(libgtlm_transfer_pool *pool);
+int libgtlm_pool_send(libgtlm_transfer_pool *pool);
+
+
+#endif // __LIBGTLM_POOL_H__
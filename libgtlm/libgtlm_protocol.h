@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_PROTOCOL_H__
+#define __LIBGTLM_PROTOCOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GTLM_PACKET_SIZE             8
+#define GTLM_ARG_NONE                0xFF
+
+// Every request is an 8 byte OUT packet followed by an 8 byte IN read-back
+// into the same buffer. A command is a fixed header followed by up to two
+// argument bytes; the reply carries its fields at fixed offsets.
+enum libgtlm_command {
+    CMD_SET_LED_STATUS  = 0,
+    CMD_SET_LED_MODE,
+    CMD_GET_VERSION,
+    CMD_GET_LED_MODE,
+    CMD_COUNT
+};
+
+typedef struct libgtlm_packet {
+    unsigned char data[GTLM_PACKET_SIZE];
+} libgtlm_packet;
+
+typedef struct libgtlm_command_layout {
+    uint8_t header[3];
+    uint8_t header_size;
+    uint8_t arg0;               // offset of the first argument or GTLM_ARG_NONE
+    uint8_t arg1;               // offset of the second argument or GTLM_ARG_NONE
+} libgtlm_command_layout;
+
+static constexpr libgtlm_command_layout kLibgtlmCommands[CMD_COUNT] = {
+    { { 0x01, 0x02, 0x30 }, 3, 3, GTLM_ARG_NONE },              // CMD_SET_LED_STATUS
+    { { 0x01, 0x02, 0x20 }, 3, 3, 4 },                          // CMD_SET_LED_MODE
+    { { 0x01, 0x10, 0x00 }, 2, GTLM_ARG_NONE, GTLM_ARG_NONE },  // CMD_GET_VERSION
+    { { 0x01, 0x01, 0x10 }, 3, GTLM_ARG_NONE, GTLM_ARG_NONE },  // CMD_GET_LED_MODE
+};
+
+// reply field offsets
+#define GTLM_REPLY_LED_STATUS        3
+#define GTLM_REPLY_LED_MODE          3
+#define GTLM_REPLY_ENABLED           4
+#define GTLM_REPLY_VERSION           2
+#define GTLM_REPLY_VERSION_SIZE      5
+
+
+constexpr bool
+libgtlm_layout_valid(const libgtlm_command_layout &layout)
+{
+    return layout.header_size <= sizeof(layout.header)
+        && (layout.arg0 == GTLM_ARG_NONE
+            || (layout.arg0 >= layout.header_size && layout.arg0 < GTLM_PACKET_SIZE))
+        && (layout.arg1 == GTLM_ARG_NONE
+            || (layout.arg0 != GTLM_ARG_NONE && layout.arg1 > layout.arg0
+                && layout.arg1 < GTLM_PACKET_SIZE));
+}
+
+
+template <libgtlm_command Command>
+constexpr libgtlm_packet
+libgtlm_encode(uint8_t arg0 = 0, uint8_t arg1 = 0)
+{
+    static_assert(Command < CMD_COUNT, "unknown command");
+    static_assert(libgtlm_layout_valid(kLibgtlmCommands[Command]),
+        "command layout overlaps or overflows the packet");
+
+    constexpr libgtlm_command_layout layout = kLibgtlmCommands[Command];
+    libgtlm_packet packet = {};
+    for (uint8_t i = 0; i < layout.header_size; i++)
+        packet.data[i] = layout.header[i];
+    if (layout.arg0 != GTLM_ARG_NONE)
+        packet.data[layout.arg0] = arg0;
+    if (layout.arg1 != GTLM_ARG_NONE)
+        packet.data[layout.arg1] = arg1;
+    return packet;
+}
+
+static_assert(libgtlm_encode<CMD_SET_LED_STATUS>(0x07).data[2] == 0x30
+    && libgtlm_encode<CMD_SET_LED_STATUS>(0x07).data[3] == 0x07,
+    "CMD_SET_LED_STATUS encoding");
+static_assert(libgtlm_encode<CMD_SET_LED_MODE>(0x05, 1).data[2] == 0x20
+    && libgtlm_encode<CMD_SET_LED_MODE>(0x05, 1).data[4] == 1,
+    "CMD_SET_LED_MODE encoding");
+static_assert(libgtlm_encode<CMD_GET_VERSION>().data[1] == 0x10
+    && libgtlm_encode<CMD_GET_VERSION>().data[2] == 0x00,
+    "CMD_GET_VERSION encoding");
+static_assert(GTLM_REPLY_VERSION + GTLM_REPLY_VERSION_SIZE <= GTLM_PACKET_SIZE
+    && GTLM_REPLY_ENABLED < GTLM_PACKET_SIZE, "reply offsets out of range");
+
+
+// Identifies a request by its header; CMD_COUNT when none matches.
+constexpr libgtlm_command
+libgtlm_decode(const libgtlm_packet &packet)
+{
+    for (int command = 0; command < CMD_COUNT; command++) {
+        const libgtlm_command_layout &layout = kLibgtlmCommands[command];
+        bool match = true;
+        for (uint8_t i = 0; i < layout.header_size; i++)
+            match = match && packet.data[i] == layout.header[i];
+        if (match)
+            return (libgtlm_command)command;
+    }
+    return CMD_COUNT;
+}
+
+static_assert(libgtlm_decode(libgtlm_encode<CMD_SET_LED_MODE>(0x05, 1))
+    == CMD_SET_LED_MODE && libgtlm_decode(libgtlm_packet{}) == CMD_COUNT,
+    "request decoding");
+
+
+typedef struct libgtlm_device_id {
+    uint16_t vendor;
+    uint16_t product;
+    const char *name;
+} libgtlm_device_id;
+
+inline constexpr libgtlm_device_id libgtlm_device_ids[] = {
+    { 0x1770, 0xFF00, "MSI GT660 LED Controller - MSI EPF USB" },
+};
+
+inline constexpr size_t kLibgtlmDeviceIdCount =
+    sizeof(libgtlm_device_ids) / sizeof(libgtlm_device_ids[0]);
+
+
+constexpr const libgtlm_device_id*
+libgtlm_find_device_id(uint16_t vendor, uint16_t product)
+{
+    for (size_t i = 0; i < kLibgtlmDeviceIdCount; i++) {
+        if (libgtlm_device_ids[i].vendor == vendor
+            && libgtlm_device_ids[i].product == product)
+            return &libgtlm_device_ids[i];
+    }
+    return NULL;
+}
+
+static_assert(libgtlm_find_device_id(0x1770, 0xFF00)->product == 0xFF00,
+    "GT660 controller missing from the device table");
+static_assert(libgtlm_find_device_id(0x0000, 0x0000) == NULL,
+    "device table lookup matches unknown ids");
+
+#endif // __LIBGTLM_PROTOCOL_H__
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include "libgtlm_pwm.h"
+
+
+struct libgtlm_pwm {
+    libgtlm_device *device;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running;
+    bool changed;               // duty cycles or effects were set
+    std::atomic<uint8_t> duty[GTLM_ZONE_COUNT];
+    libgtlm_pwm_effect effects[GTLM_ZONE_COUNT];    // mode 0: use duty
+    uint64_t epoch;             // effect phases count from here
+    libgtlm_pwm_stats stats;
+    std::atomic<uint32_t> tick_rate;
+    std::atomic<uint32_t> toggle_rate;
+    uint64_t min_interval;
+    uint8_t saved_status;
+    uint8_t saved_mode;
+    bool saved_enabled;
+};
+
+
+// Deadlines are libgtlm_time_ns() values, which need not be steady_clock
+// time (libgtlm_set_clock); wait for what is left of them instead.
+static std::chrono::nanoseconds
+libgtlm_pwm_remaining(uint64_t deadline)
+{
+    uint64_t now = libgtlm_time_ns();
+    return std::chrono::nanoseconds(deadline > now ? deadline - now : 0);
+}
+
+
+// Duty cycle of an effect time ns after the epoch. Blinking zones also
+// lower edge to the ns left until they next switch.
+static uint8_t
+libgtlm_pwm_effect_duty(const libgtlm_pwm_effect *effect, uint64_t time,
+    uint64_t *edge)
+{
+    if (effect->mode == MODE_ALWAYS)
+        return GTLM_PWM_DUTY_MAX;
+
+    uint64_t period = effect->period * 1000000ULL;
+    uint64_t half = period / 2;
+    uint64_t position = (time + effect->phase * 1000000ULL) % period;
+    if (effect->mode == MODE_BLINK) {
+        uint64_t left = (position < half ? half : period) - position;
+        if (left < *edge)
+            *edge = left;
+        return position < half ? GTLM_PWM_DUTY_MAX : 0;
+    }
+
+    // up and down again, squared so the fade looks even
+    uint64_t ramp = position < half ? position : period - position;
+    uint64_t level = ramp * GTLM_PWM_DUTY_MAX / half;
+    return level * level / GTLM_PWM_DUTY_MAX;
+}
+
+
+static void
+libgtlm_pwm_thread(libgtlm_pwm *pwm)
+{
+    libgtlm_device *device = pwm->device;
+    libgtlm_pwm_effect effects[GTLM_ZONE_COUNT];
+    uint32_t accumulator[GTLM_ZONE_COUNT] = { 0, 0, 0 };
+    uint64_t transferTime = pwm->min_interval;
+    uint64_t next = libgtlm_time_ns();
+    uint64_t windowStart = next;
+    uint32_t ticks = 0;
+    uint32_t toggles = 0;
+    libgtlm_trace_thread_name("pwm");
+
+    std::unique_lock<std::mutex> lock(pwm->lock);
+    while (pwm->running) {
+        memcpy(effects, pwm->effects, sizeof(effects));
+        pwm->changed = false;
+        lock.unlock();
+
+        uint64_t now = libgtlm_time_ns();
+        uint64_t edge = UINT64_MAX;
+        bool dimming = false;
+        uint8_t mask = 0;
+        for (int i = 0; i < GTLM_ZONE_COUNT; i++) {
+            uint8_t duty = effects[i].mode
+                ? libgtlm_pwm_effect_duty(&effects[i], now - pwm->epoch, &edge)
+                : pwm->duty[i].load(std::memory_order_relaxed);
+            if (effects[i].mode == MODE_BREATH
+                || (duty != 0 && duty != GTLM_PWM_DUTY_MAX))
+                dimming = true;
+
+            accumulator[i] += duty;
+            if (accumulator[i] >= GTLM_PWM_DUTY_MAX) {
+                accumulator[i] -= GTLM_PWM_DUTY_MAX;
+                mask |= 1 << i;
+            }
+        }
+
+        bool toggled = mask != device->led_status;
+        bool failed = false;
+        if (toggled) {
+            uint8_t previous = device->led_status;
+            device->led_status = mask;
+            uint64_t start = libgtlm_time_ns();
+            // a zone left as it was is resent on the next tick
+            if (libgtlm_send_led_status(device) < 0) {
+                device->led_status = previous;
+                toggled = false;
+                failed = true;
+            }
+            uint64_t end = libgtlm_time_ns();
+            if (libgtlm_trace_enabled())
+                libgtlm_trace_span("frame", "pwm", start, end);
+            transferTime = (7 * transferTime + end - start) / 8;
+            if (toggled)
+                toggles++;
+        }
+        ticks++;
+
+        // Never schedule ticks faster than the controller has been taking
+        // packets; when a transfer overruns, restart from now instead of
+        // bursting to catch up.
+        uint64_t end = libgtlm_time_ns();
+        next += transferTime > pwm->min_interval ? transferTime
+            : pwm->min_interval;
+        if (next < end)
+            next = end;
+
+        if (end - windowStart >= 1000000000ULL) {
+            pwm->tick_rate.store(ticks, std::memory_order_relaxed);
+            pwm->toggle_rate.store(toggles, std::memory_order_relaxed);
+            windowStart = end;
+            ticks = 0;
+            toggles = 0;
+        }
+
+        // blink edges are exact times, not ticks: wake right at the next one
+        uint64_t deadline = dimming || failed ? next : UINT64_MAX;
+        if (edge != UINT64_MAX && now + edge < deadline)
+            deadline = now + edge;
+
+        lock.lock();
+        pwm->stats.ticks++;
+        if (toggled)
+            pwm->stats.toggles++;
+        if (deadline == UINT64_MAX) {
+            // every zone is steadily on or off: nothing to toggle until the
+            // duty cycles or effects change
+            pwm->tick_rate.store(0, std::memory_order_relaxed);
+            pwm->toggle_rate.store(0, std::memory_order_relaxed);
+            pwm->wake.wait(lock, [pwm] {
+                return !pwm->running || pwm->changed; });
+            next = windowStart = libgtlm_time_ns();
+            ticks = toggles = 0;
+        } else if (!pwm->wake.wait_for(lock, libgtlm_pwm_remaining(deadline),
+                [pwm] { return !pwm->running || pwm->changed; })) {
+            // a virtual clock may not have moved while we slept
+            uint64_t woke = libgtlm_time_ns();
+            libgtlm_latency_add(&pwm->stats.jitter,
+                woke > deadline ? woke - deadline : 0);
+        }
+    }
+}
+
+
+libgtlm_pwm*
+libgtlm_pwm_start(libgtlm_device *device, uint32_t maxRate)
+{
+    if (device == NULL || maxRate == 0)
+        return NULL;
+
+    libgtlm_pwm *pwm = new libgtlm_pwm;
+    pwm->device = device;
+    pwm->running = true;
+    pwm->changed = false;
+    for (int i = 0; i < GTLM_ZONE_COUNT; i++)
+        pwm->duty[i] = (device->led_status & (1 << i)) ? GTLM_PWM_DUTY_MAX : 0;
+    memset(pwm->effects, 0, sizeof(pwm->effects));
+    memset(&pwm->stats, 0, sizeof(pwm->stats));
+    pwm->epoch = libgtlm_time_ns();
+    pwm->tick_rate = 0;
+    pwm->toggle_rate = 0;
+    // rates above 1 GHz would round the interval down to nothing
+    pwm->min_interval = maxRate < 1000000000 ? 1000000000ULL / maxRate : 1;
+    pwm->saved_status = device->led_status;
+    pwm->saved_mode = device->led_mode;
+    pwm->saved_enabled = device->enabled;
+
+    libgtlm_set_led_mode(device, MODE_ALWAYS, true);
+    if (libgtlm_sync(device) < 0) {
+        delete pwm;
+        return NULL;
+    }
+
+    pwm->thread = std::thread(libgtlm_pwm_thread, pwm);
+    return pwm;
+}
+
+
+void
+libgtlm_pwm_stop(libgtlm_pwm *pwm)
+{
+    if (pwm == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pwm->lock);
+        pwm->running = false;
+    }
+    pwm->wake.notify_one();
+    pwm->thread.join();
+
+    libgtlm_device *device = pwm->device;
+    device->led_status = pwm->saved_status;
+    libgtlm_set_led_mode(device, (libgtlm_led_mode)pwm->saved_mode,
+        pwm->saved_enabled);
+    libgtlm_sync(device);
+    delete pwm;
+}
+
+
+void
+libgtlm_pwm_set_duty(libgtlm_pwm *pwm, uint8_t zones, uint8_t duty)
+{
+    if (pwm == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pwm->lock);
+        for (int i = 0; i < GTLM_ZONE_COUNT; i++) {
+            if (zones & (1 << i)) {
+                pwm->duty[i].store(duty, std::memory_order_relaxed);
+                pwm->effects[i].mode = 0;
+            }
+        }
+        pwm->changed = true;
+    }
+    pwm->wake.notify_one();
+}
+
+
+bool
+libgtlm_pwm_set_effect(libgtlm_pwm *pwm, uint8_t zones,
+    const libgtlm_pwm_effect *effect)
+{
+    if (pwm == NULL || effect == NULL)
+        return false;
+    if (effect->mode != MODE_ALWAYS && effect->mode != MODE_BLINK
+        && effect->mode != MODE_BREATH)
+        return false;
+    if (effect->mode != MODE_ALWAYS && effect->period == 0)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(pwm->lock);
+        for (int i = 0; i < GTLM_ZONE_COUNT; i++) {
+            if (zones & (1 << i))
+                pwm->effects[i] = *effect;
+        }
+        pwm->changed = true;
+    }
+    pwm->wake.notify_one();
+    return true;
+}
+
+
+uint8_t
+libgtlm_pwm_get_duty(libgtlm_pwm *pwm, uint8_t zone)
+{
+    if (pwm == NULL)
+        return 0;
+
+    for (int i = 0; i < GTLM_ZONE_COUNT; i++) {
+        if (zone & (1 << i))
+            return pwm->duty[i].load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+
+uint32_t
+libgtlm_pwm_get_tick_rate(libgtlm_pwm *pwm)
+{
+    return pwm ? pwm->tick_rate.load(std::memory_order_relaxed) : 0;
+}
+
+
+uint32_t
+libgtlm_pwm_get_toggle_rate(libgtlm_pwm *pwm)
+{
+    return pwm ? pwm->toggle_rate.load(std::memory_order_relaxed) : 0;
+}
+
+
+void
+libgtlm_pwm_get_stats(libgtlm_pwm *pwm, libgtlm_pwm_stats *stats)
+{
+    if (pwm == NULL || stats == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(pwm->lock);
+    *stats = pwm->stats;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_PWM_H__
+#define __LIBGTLM_PWM_H__
+
+#include "libgtlm.h"
+
+typedef struct libgtlm_pwm libgtlm_pwm;
+
+#define GTLM_PWM_DUTY_MAX            255
+
+// Per-zone software version of a firmware mode, which the controller can
+// only apply to every zone at once. A blinking zone is on for the first
+// half of its period, a breathing one fades up and back down over it;
+// phase (ms) shifts the zone within its cycle, so zones with the same
+// period can run in step or against each other.
+typedef struct libgtlm_pwm_effect {
+    uint8_t mode;               // MODE_ALWAYS, MODE_BLINK or MODE_BREATH
+    uint32_t period;            // ms
+    uint32_t phase;             // ms
+} libgtlm_pwm_effect;
+
+typedef struct libgtlm_pwm_stats {
+    uint64_t ticks;
+    uint64_t toggles;           // ticks that changed the mask
+    libgtlm_latency jitter;     // ns each timed tick woke after its deadline
+} libgtlm_pwm_stats;
+
+// Software dimming on top of the on/off zone bits. A timing thread toggles
+// the zones as fast as the controller accepts single zone packets (capped at
+// maxRate ticks per second) and spreads each zone's on-time over the ticks
+// with a per-zone accumulator, so brightness resolution follows whatever
+// rate the device sustains. Only ticks that change the mask hit the bus.
+// Zones that are fully on or off cost nothing: with blinking zones the
+// thread sleeps until the next edge, otherwise until something changes.
+//
+// While running, the thread owns the device: the caller must not sync it
+// from elsewhere. The LEDs are put in MODE_ALWAYS, and the previous zone
+// mask and mode are restored on stop.
+libgtlm_pwm* libgtlm_pwm_start(libgtlm_device *device, uint32_t maxRate);
+void libgtlm_pwm_stop(libgtlm_pwm *pwm);
+void libgtlm_pwm_set_duty(libgtlm_pwm *pwm, uint8_t zones, uint8_t duty);
+uint8_t libgtlm_pwm_get_duty(libgtlm_pwm *pwm, uint8_t zone);
+// Runs an effect on zones instead of a fixed duty cycle, until the next
+// libgtlm_pwm_set_duty() on them. False for other modes or a zero period.
+bool libgtlm_pwm_set_effect(libgtlm_pwm *pwm, uint8_t zones,
+    const libgtlm_pwm_effect *effect);
+void libgtlm_pwm_get_stats(libgtlm_pwm *pwm, libgtlm_pwm_stats *stats);
+
+// Measured over the last second.
+uint32_t libgtlm_pwm_get_tick_rate(libgtlm_pwm *pwm);
+uint32_t libgtlm_pwm_get_toggle_rate(libgtlm_pwm *pwm);
+
+#endif // __LIBGTLM_PWM_H__
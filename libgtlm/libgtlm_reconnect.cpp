@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+#include "libgtlm.h"
+#include "libgtlm_sysfs.h"
+
+// first retry after 1 ms, doubling up to 20 ms
+#define GTLM_RECONNECT_BACKOFF_MIN   1000000ULL
+#define GTLM_RECONNECT_BACKOFF_MAX   20000000ULL
+
+
+struct libgtlm_reconnect {
+    const libgtlm_device_id *id;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running;
+    std::atomic<bool> active;
+    std::atomic<bool> ready;
+    std::atomic<bool> replay;   // handle taken, state not replayed yet
+    libusb_device_handle *handle;
+    int fd;
+    uint64_t lost_at;
+    libgtlm_reconnect_stats stats;
+};
+
+
+static libusb_device_handle*
+libgtlm_reconnect_open(libgtlm_reconnect *reconnect, int *fd)
+{
+    libusb_device_handle *handle = NULL;
+    *fd = -1;
+#ifdef GTLM_HAVE_SYSFS_OPEN
+    // the node the device came back on, without a device list
+    *fd = libgtlm_sysfs_open(NULL);
+    if (*fd >= 0 && libusb_wrap_sys_device(NULL, *fd, &handle) < 0) {
+        close(*fd);
+        *fd = -1;
+        handle = NULL;
+    }
+#endif
+    if (handle == NULL)
+        handle = libusb_open_device_with_vid_pid(NULL, reconnect->id->vendor,
+            reconnect->id->product);
+    if (handle == NULL)
+        return NULL;
+
+    if (libusb_kernel_driver_active(handle, 0) == 1
+        && libusb_detach_kernel_driver(handle, 0) < 0)
+        goto error;
+    if (libusb_claim_interface(handle, 0x00) < 0)
+        goto error;
+    return handle;
+
+error:
+    libusb_close(handle);
+#ifdef __linux__
+    if (*fd >= 0)
+        close(*fd);
+#endif
+    *fd = -1;
+    return NULL;
+}
+
+
+static void
+libgtlm_reconnect_thread(libgtlm_reconnect *reconnect)
+{
+    uint64_t backoff = GTLM_RECONNECT_BACKOFF_MIN;
+    libgtlm_trace_thread_name("reconnect");
+    std::unique_lock<std::mutex> lock(reconnect->lock);
+    while (reconnect->running) {
+        lock.unlock();
+        int fd = -1;
+        uint64_t trace = GTLM_TRACE_BEGIN();
+        libusb_device_handle *handle = libgtlm_reconnect_open(reconnect, &fd);
+        GTLM_TRACE_END("reconnect", handle ? "reopen" : "reopen failed", trace);
+        lock.lock();
+
+        if (handle) {
+            reconnect->handle = handle;
+            reconnect->fd = fd;
+            reconnect->stats.last_reopen = libgtlm_time_ns() - reconnect->lost_at;
+            reconnect->ready.store(true, std::memory_order_release);
+            GTLM_LOG(SUBSYSTEM_RECONNECT, LEVEL_DEBUG, "re-opened after %.1f ms",
+                reconnect->stats.last_reopen / 1e6);
+            return;
+        }
+
+        reconnect->wake.wait_for(lock, std::chrono::nanoseconds(backoff),
+            [reconnect] { return !reconnect->running; });
+        backoff = backoff * 2 < GTLM_RECONNECT_BACKOFF_MAX ? backoff * 2
+            : GTLM_RECONNECT_BACKOFF_MAX;
+    }
+}
+
+
+static void
+libgtlm_reconnect_stop(libgtlm_reconnect *reconnect)
+{
+    if (!reconnect->thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(reconnect->lock);
+        reconnect->running = false;
+    }
+    reconnect->wake.notify_one();
+    reconnect->thread.join();
+}
+
+
+libgtlm_reconnect*
+libgtlm_reconnect_new(const libgtlm_device_id *id)
+{
+    if (id == NULL)
+        return NULL;
+
+    libgtlm_reconnect *reconnect = new libgtlm_reconnect;
+    reconnect->id = id;
+    reconnect->running = false;
+    reconnect->active = false;
+    reconnect->ready = false;
+    reconnect->replay = false;
+    reconnect->handle = NULL;
+    reconnect->fd = -1;
+    reconnect->lost_at = 0;
+    reconnect->stats = libgtlm_reconnect_stats();
+    return reconnect;
+}
+
+
+void
+libgtlm_reconnect_free(libgtlm_reconnect *reconnect)
+{
+    if (reconnect == NULL)
+        return;
+
+    libgtlm_reconnect_stop(reconnect);
+    if (reconnect->handle) {
+        libusb_release_interface(reconnect->handle, 0x00);
+        libusb_close(reconnect->handle);
+#ifdef __linux__
+        if (reconnect->fd >= 0)
+            close(reconnect->fd);
+#endif
+    }
+    delete reconnect;
+}
+
+
+void
+libgtlm_reconnect_begin(libgtlm_reconnect *reconnect)
+{
+    if (reconnect == NULL || reconnect->active.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> lock(reconnect->lock);
+    // lost again before the replay went through: still the same outage
+    if (!reconnect->replay.load(std::memory_order_relaxed)) {
+        reconnect->lost_at = libgtlm_time_ns();
+        reconnect->stats.losses++;
+    }
+    reconnect->stats.pending = true;
+    reconnect->running = true;
+    reconnect->ready.store(false, std::memory_order_relaxed);
+    reconnect->active.store(true, std::memory_order_relaxed);
+    reconnect->thread = std::thread(libgtlm_reconnect_thread, reconnect);
+    GTLM_LOG(SUBSYSTEM_RECONNECT, LEVEL_INFO, "controller lost, reconnecting");
+}
+
+
+bool
+libgtlm_reconnect_active(libgtlm_reconnect *reconnect)
+{
+    return reconnect && reconnect->active.load(std::memory_order_relaxed);
+}
+
+
+// NULL while the device has not come back yet; fd is the usbfs descriptor
+// behind the handle when it was opened through sysfs, -1 otherwise. Once
+// taken, a further loss starts a new reconnect.
+libusb_device_handle*
+libgtlm_reconnect_take(libgtlm_reconnect *reconnect, int *fd)
+{
+    if (reconnect == NULL || !reconnect->ready.load(std::memory_order_acquire))
+        return NULL;
+
+    reconnect->thread.join();
+    libusb_device_handle *handle = reconnect->handle;
+    *fd = reconnect->fd;
+    reconnect->handle = NULL;
+    reconnect->fd = -1;
+    reconnect->ready.store(false, std::memory_order_relaxed);
+    reconnect->replay.store(true, std::memory_order_relaxed);
+    reconnect->active.store(false, std::memory_order_relaxed);
+    return handle;
+}
+
+
+// True from take() until done(), while the state is owed to the new handle.
+bool
+libgtlm_reconnect_replaying(libgtlm_reconnect *reconnect)
+{
+    return reconnect && reconnect->replay.load(std::memory_order_relaxed);
+}
+
+
+// Called once the state has been replayed on the new handle.
+void
+libgtlm_reconnect_done(libgtlm_reconnect *reconnect)
+{
+    if (reconnect == NULL)
+        return;
+
+    reconnect->replay.store(false, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(reconnect->lock);
+    reconnect->stats.reconnects++;
+    reconnect->stats.last_recovery = libgtlm_time_ns() - reconnect->lost_at;
+    reconnect->stats.pending = false;
+    GTLM_LOG(SUBSYSTEM_RECONNECT, LEVEL_INFO, "state replayed after %.1f ms",
+        reconnect->stats.last_recovery / 1e6);
+}
+
+
+void
+libgtlm_reconnect_get_stats(libgtlm_reconnect *reconnect,
+    libgtlm_reconnect_stats *stats)
+{
+    if (reconnect == NULL || stats == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(reconnect->lock);
+    *stats = reconnect->stats;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_RECONNECT_H__
+#define __LIBGTLM_RECONNECT_H__
+
+#include "libusb.h"
+#include "libgtlm_protocol.h"
+
+typedef struct libgtlm_reconnect libgtlm_reconnect;
+
+typedef struct libgtlm_reconnect_stats {
+    uint64_t losses;            // NO_DEVICE errors that started a reconnect
+    uint64_t reconnects;
+    uint64_t last_reopen;       // ns from the loss until the device was claimed
+    uint64_t last_recovery;     // ns from the loss until the state was replayed
+    bool pending;
+} libgtlm_reconnect_stats;
+
+// Background re-open of a lost controller. begin() starts a thread that
+// polls for the device with a short backoff and re-claims it on the
+// existing libusb context; take() hands the claimed handle over once it is
+// ready and done() records the recovery once the state was replayed on
+// it, which may take several attempts. Used by libgtlm.cpp.
+libgtlm_reconnect* libgtlm_reconnect_new(const libgtlm_device_id *id);
+void libgtlm_reconnect_free(libgtlm_reconnect *reconnect);
+void libgtlm_reconnect_begin(libgtlm_reconnect *reconnect);
+bool libgtlm_reconnect_active(libgtlm_reconnect *reconnect);
+libusb_device_handle* libgtlm_reconnect_take(libgtlm_reconnect *reconnect,
+    int *fd);
+bool libgtlm_reconnect_replaying(libgtlm_reconnect *reconnect);
+void libgtlm_reconnect_done(libgtlm_reconnect *reconnect);
+void libgtlm_reconnect_get_stats(libgtlm_reconnect *reconnect,
+    libgtlm_reconnect_stats *stats);
+
+#endif // __LIBGTLM_RECONNECT_H__
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include "libgtlm_restore.h"
+#include "libgtlm_sysfs.h"
+
+#define GTLM_STATE_MAGIC             0x47
+
+typedef struct libgtlm_state_record {
+    uint8_t magic;
+    uint8_t led_status;
+    uint8_t led_mode;
+    uint8_t enabled;
+} libgtlm_state_record;
+
+
+static char*
+libgtlm_state_path(const char *suffix)
+{
+    char *home = getenv("HOME");
+    if (home == NULL)
+        return NULL;
+
+    int len = strlen(home) + strlen(GTLM_STATE_CACHE) + strlen(suffix) + 1;
+    char *path = (char*)malloc(len);
+    if (path)
+        snprintf(path, len, "%s%s%s", home, GTLM_STATE_CACHE, suffix);
+    return path;
+}
+
+
+bool
+libgtlm_save_state(libgtlm_device *device)
+{
+    if (device == NULL)
+        return false;
+
+    libgtlm_state_record record;
+    record.magic = GTLM_STATE_MAGIC;
+    record.led_status = device->led_status;
+    record.led_mode = device->led_mode;
+    record.enabled = device->enabled;
+
+    // written aside and renamed over, so a restore never sees half a record
+    char *path = libgtlm_state_path("");
+    char *temp = libgtlm_state_path(".tmp");
+    bool saved = false;
+    if (path && temp) {
+        int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            saved = write(fd, &record, sizeof(record)) == sizeof(record);
+            close(fd);
+            if (saved)
+                saved = rename(temp, path) == 0;
+            else
+                unlink(temp);
+        }
+    }
+    free(path);
+    free(temp);
+    return saved;
+}
+
+
+bool
+libgtlm_load_state(libgtlm_frame *frame)
+{
+    char *path = libgtlm_state_path("");
+    if (path == NULL)
+        return false;
+
+    libgtlm_state_record record;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return false;
+    ssize_t length = read(fd, &record, sizeof(record));
+    close(fd);
+
+    if (length != sizeof(record) || record.magic != GTLM_STATE_MAGIC
+        || (record.led_status & ~LEDS_ALL) != 0
+        || record.led_mode < MODE_BLINK || record.led_mode > MODE_ALWAYS)
+        return false;
+
+    frame->led_status = record.led_status;
+    frame->led_mode = record.led_mode;
+    frame->enabled = record.enabled != 0;
+    return true;
+}
+
+
+int
+libgtlm_restore(libgtlm_restore_stats *stats)
+{
+    uint64_t start = libgtlm_time_ns();
+    libgtlm_restore_stats local;
+    if (stats == NULL)
+        stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    libgtlm_frame frame;
+    if (!libgtlm_load_state(&frame))
+        return LIBUSB_ERROR_NOT_FOUND;
+
+    libgtlm_packet packets[2];
+    uint32_t count = 0;
+    if (frame.led_status != GTLM_POWER_ON_STATUS)
+        packets[count++] = libgtlm_encode<CMD_SET_LED_STATUS>(frame.led_status);
+    if (frame.led_mode != GTLM_POWER_ON_MODE
+        || frame.enabled != GTLM_POWER_ON_ENABLED)
+        packets[count++] = libgtlm_encode<CMD_SET_LED_MODE>(frame.led_mode,
+            frame.enabled);
+
+    // the controller already shows the saved state
+    if (count == 0) {
+        stats->total_time = libgtlm_time_ns() - start;
+        return LIBUSB_SUCCESS;
+    }
+
+    int fd = libgtlm_sysfs_open(NULL);
+    if (fd < 0)
+        return LIBUSB_ERROR_NO_DEVICE;
+    int result = libgtlm_sysfs_claim(fd);
+    stats->open_time = libgtlm_time_ns() - start;
+
+    for (uint32_t i = 0; i < count && result == LIBUSB_SUCCESS; i++) {
+        struct usbdevfs_ctrltransfer control;
+        control.bRequestType = GTLM_CONFIG_REQUEST_TYPE_OUT;
+        control.bRequest = LIBUSB_REQUEST_SET_CONFIGURATION;
+        control.wValue = GTLM_CONFIG_VALUE;
+        control.wIndex = GTLM_CONFIG_INDEX;
+        control.wLength = GTLM_PACKET_SIZE;
+        control.timeout = GTLM_RESTORE_TIMEOUT;
+        control.data = packets[i].data;
+        if (ioctl(fd, USBDEVFS_CONTROL, &control) < 0)
+            result = libgtlm_sysfs_error(errno);
+        else
+            stats->packets++;
+    }
+
+    close(fd);
+    stats->total_time = libgtlm_time_ns() - start;
+    if (result < 0)
+        GTLM_REPORT_ERROR(result);
+    return result;
+}
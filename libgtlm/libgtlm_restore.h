@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_RESTORE_H__
+#define __LIBGTLM_RESTORE_H__
+
+#include "libgtlm.h"
+
+// Last applied state, relative to $HOME.
+#define GTLM_STATE_CACHE             "/.gtlm-state"
+#define GTLM_RESTORE_TIMEOUT         1000            // ms per packet
+
+typedef struct libgtlm_restore_stats {
+    uint64_t open_time;         // ns to find, open and claim the controller
+    uint64_t total_time;        // ns until the last packet was accepted
+    uint32_t packets;           // OUT packets sent
+} libgtlm_restore_stats;
+
+// Compact copy of the zone mask, mode and enabled flag, written along with
+// the config so a restore needs no libconfig parse.
+bool libgtlm_save_state(libgtlm_device *device);
+bool libgtlm_load_state(libgtlm_frame *frame);
+
+// Boot and resume fast path (Linux only): loads the saved state, opens the
+// controller through the cached sysfs entry and pushes only the OUT
+// packets that differ from the power-on state straight through usbfs. No
+// libusb context, mode read-back or config parse is involved. Returns
+// LIBUSB_ERROR_NOT_FOUND without a saved state so the caller can fall back
+// to libgtlm_init_with_config.
+int libgtlm_restore(libgtlm_restore_stats *stats);
+
+#endif // __LIBGTLM_RESTORE_H__
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "libgtlm_restore.h"
+#include "libgtlm_schedule.h"
+
+// Four levels of 64 slots at one second per tick cover about 194 days,
+// far more than the day or so between two transitions of a rule.
+#define GTLM_WHEEL_LEVELS            4
+#define GTLM_WHEEL_BITS              6
+#define GTLM_WHEEL_SLOTS             (1 << GTLM_WHEEL_BITS)
+#define GTLM_WHEEL_MASK              (GTLM_WHEEL_SLOTS - 1)
+#define GTLM_WHEEL_NONE              UINT64_MAX
+
+// seconds before a transition whose sync failed is tried again
+#define GTLM_SCHEDULE_RETRY          5
+
+static const char *kDayNames[7] = {
+    "sun", "mon", "tue", "wed", "thu", "fri", "sat"
+};
+
+typedef struct libgtlm_wheel_timer {
+    uint64_t expiry;            // seconds since the epoch
+    int rule;
+    bool end;                   // the rule's end rather than its start
+    bool queued;
+    struct libgtlm_wheel_timer *prev;
+    struct libgtlm_wheel_timer *next;
+} libgtlm_wheel_timer;
+
+// A timer sits on the lowest level whose slot range still shares every
+// higher digit with now, so level 0 holds the next 64 seconds and each
+// level above only times later than everything below it.
+typedef struct libgtlm_wheel {
+    uint64_t now;
+    libgtlm_wheel_timer *slots[GTLM_WHEEL_LEVELS][GTLM_WHEEL_SLOTS];
+} libgtlm_wheel;
+
+struct libgtlm_schedule {
+    libgtlm_device *device;
+    libgtlm_loop *loop;
+    int timer_fd;
+    libgtlm_frame base;
+    bool pending;               // sync even if the device fields match
+    libgtlm_schedule_rule rules[GTLM_SCHEDULE_MAX_RULES];
+    libgtlm_wheel_timer timers[GTLM_SCHEDULE_MAX_RULES * 2];
+    int rule_count;
+    libgtlm_wheel wheel;
+    libgtlm_schedule_stats stats;
+};
+
+
+static void
+libgtlm_wheel_insert(libgtlm_wheel *wheel, libgtlm_wheel_timer *timer)
+{
+    if (timer->expiry < wheel->now)
+        timer->expiry = wheel->now;
+    // beyond the top level: park it at the far end, it is re-armed from
+    // there when it comes due
+    uint64_t span = 1ULL << (GTLM_WHEEL_BITS * GTLM_WHEEL_LEVELS);
+    if ((timer->expiry ^ wheel->now) >= span)
+        timer->expiry = wheel->now | (span - 1);
+
+    int level = 0;
+    while (level < GTLM_WHEEL_LEVELS - 1
+        && ((timer->expiry ^ wheel->now) >> (GTLM_WHEEL_BITS * (level + 1))) != 0)
+        level++;
+    int slot = (timer->expiry >> (GTLM_WHEEL_BITS * level)) & GTLM_WHEEL_MASK;
+
+    libgtlm_wheel_timer **head = &wheel->slots[level][slot];
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head)
+        (*head)->prev = timer;
+    *head = timer;
+    timer->queued = true;
+}
+
+
+static void
+libgtlm_wheel_remove(libgtlm_wheel *wheel, libgtlm_wheel_timer *timer)
+{
+    if (!timer->queued)
+        return;
+
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else {
+        for (int level = 0; level < GTLM_WHEEL_LEVELS; level++) {
+            int slot = (timer->expiry >> (GTLM_WHEEL_BITS * level))
+                & GTLM_WHEEL_MASK;
+            if (wheel->slots[level][slot] == timer) {
+                wheel->slots[level][slot] = timer->next;
+                break;
+            }
+        }
+    }
+    timer->queued = false;
+}
+
+
+// The first occupied slot from now on, lowest level first, holds the
+// earliest timer; on level 0 all of a slot's timers expire together.
+static uint64_t
+libgtlm_wheel_next(libgtlm_wheel *wheel)
+{
+    for (int level = 0; level < GTLM_WHEEL_LEVELS; level++) {
+        int slot = (wheel->now >> (GTLM_WHEEL_BITS * level)) & GTLM_WHEEL_MASK;
+        for (; slot < GTLM_WHEEL_SLOTS; slot++) {
+            libgtlm_wheel_timer *timer = wheel->slots[level][slot];
+            if (timer == NULL)
+                continue;
+            uint64_t expiry = GTLM_WHEEL_NONE;
+            for (; timer; timer = timer->next) {
+                if (timer->expiry < expiry)
+                    expiry = timer->expiry;
+            }
+            return expiry;
+        }
+    }
+    return GTLM_WHEEL_NONE;
+}
+
+
+// Moves now forward to a time no timer is due before. Timers on the slot
+// now enters at each level share one more digit with it and drop a level.
+static void
+libgtlm_wheel_set_now(libgtlm_wheel *wheel, uint64_t now)
+{
+    wheel->now = now;
+    for (int level = GTLM_WHEEL_LEVELS - 1; level > 0; level--) {
+        int slot = (now >> (GTLM_WHEEL_BITS * level)) & GTLM_WHEEL_MASK;
+        libgtlm_wheel_timer *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        while (timer) {
+            libgtlm_wheel_timer *next = timer->next;
+            libgtlm_wheel_insert(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+
+// Unlinks the timers due at or before now and returns them as a list.
+static libgtlm_wheel_timer*
+libgtlm_wheel_advance(libgtlm_wheel *wheel, uint64_t now)
+{
+    libgtlm_wheel_timer *expired = NULL;
+    uint64_t next;
+    while ((next = libgtlm_wheel_next(wheel)) <= now) {
+        libgtlm_wheel_set_now(wheel, next);
+        libgtlm_wheel_timer **head = &wheel->slots[0][next & GTLM_WHEEL_MASK];
+        while (*head) {
+            libgtlm_wheel_timer *timer = *head;
+            *head = timer->next;
+            timer->queued = false;
+            timer->prev = NULL;
+            timer->next = expired;
+            expired = timer;
+        }
+    }
+    libgtlm_wheel_set_now(wheel, now);
+    return expired;
+}
+
+
+// Next local time of day after now, through mktime so DST shifts land on
+// the right second.
+static uint64_t
+libgtlm_schedule_next_time(time_t now, uint16_t minute)
+{
+    struct tm local;
+    localtime_r(&now, &local);
+    for (int day = 0; day < 3; day++) {
+        struct tm candidate = local;
+        candidate.tm_mday += day;
+        candidate.tm_hour = minute / 60;
+        candidate.tm_min = minute % 60;
+        candidate.tm_sec = 0;
+        candidate.tm_isdst = -1;
+        time_t when = mktime(&candidate);
+        if (when > now)
+            return when;
+    }
+    return now + 24 * 3600;
+}
+
+
+static bool
+libgtlm_schedule_active(const libgtlm_schedule_rule *rule,
+    const struct tm *local)
+{
+    int minute = local->tm_hour * 60 + local->tm_min;
+    uint8_t days = rule->days ? rule->days : 0x7f;
+    bool today = days & (1 << local->tm_wday);
+    bool yesterday = days & (1 << ((local->tm_wday + 6) % 7));
+
+    if (rule->start == rule->end)
+        return today;
+    if (rule->start < rule->end)
+        return today && minute >= rule->start && minute < rule->end;
+    return (today && minute >= rule->start) || (yesterday && minute < rule->end);
+}
+
+
+static void
+libgtlm_schedule_arm(libgtlm_schedule *schedule, libgtlm_wheel_timer *timer,
+    time_t now)
+{
+    const libgtlm_schedule_rule *rule = &schedule->rules[timer->rule];
+    timer->expiry = libgtlm_schedule_next_time(now,
+        timer->end ? rule->end : rule->start);
+    libgtlm_wheel_insert(&schedule->wheel, timer);
+}
+
+
+static void
+libgtlm_schedule_rebuild(libgtlm_schedule *schedule, time_t now)
+{
+    memset(&schedule->wheel, 0, sizeof(schedule->wheel));
+    schedule->wheel.now = now;
+    for (int i = 0; i < schedule->rule_count * 2; i++)
+        libgtlm_schedule_arm(schedule, &schedule->timers[i], now);
+}
+
+
+static void
+libgtlm_schedule_on_timer(libgtlm_loop*, int fd, uint32_t, void *data)
+{
+    libgtlm_schedule *schedule = (libgtlm_schedule*)data;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno == ECANCELED) {
+        GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_INFO,
+            "schedule: clock set, rebuilding");
+        schedule->stats.clock_changes++;
+        libgtlm_schedule_rebuild(schedule, time(NULL));
+    }
+    libgtlm_schedule_update(schedule);
+}
+
+
+libgtlm_schedule*
+libgtlm_schedule_new(libgtlm_device *device, libgtlm_loop *loop)
+{
+    if (device == NULL || loop == NULL)
+        return NULL;
+
+    libgtlm_schedule *schedule = (libgtlm_schedule*)malloc(sizeof(*schedule));
+    if (schedule == NULL)
+        return NULL;
+
+    memset(schedule, 0, sizeof(*schedule));
+    schedule->device = device;
+    schedule->loop = loop;
+    schedule->base.led_status = device->led_status;
+    schedule->base.led_mode = device->led_mode;
+    schedule->base.enabled = device->enabled;
+    schedule->wheel.now = time(NULL);
+    schedule->timer_fd = timerfd_create(CLOCK_REALTIME,
+        TFD_NONBLOCK | TFD_CLOEXEC);
+    if (schedule->timer_fd < 0)
+        goto error;
+    if (libgtlm_loop_add_fd(loop, schedule->timer_fd, EPOLLIN,
+        libgtlm_schedule_on_timer, schedule) < 0)
+        goto error;
+    return schedule;
+
+error:
+    if (schedule->timer_fd >= 0)
+        close(schedule->timer_fd);
+    free(schedule);
+    return NULL;
+}
+
+
+void
+libgtlm_schedule_free(libgtlm_schedule *schedule)
+{
+    if (schedule == NULL)
+        return;
+
+    libgtlm_loop_remove_fd(schedule->loop, schedule->timer_fd);
+    close(schedule->timer_fd);
+    free(schedule);
+}
+
+
+static bool
+libgtlm_schedule_parse_time(const char *text, uint16_t *minute)
+{
+    unsigned hours, minutes;
+    char end;
+    if (text == NULL
+        || sscanf(text, "%u:%u%c", &hours, &minutes, &end) != 2
+        || hours > 24 || minutes > 59 || (hours == 24 && minutes != 0))
+        return false;
+    *minute = (hours % 24) * 60 + minutes;
+    return true;
+}
+
+
+static int
+libgtlm_schedule_parse_day(const char *text, size_t len)
+{
+    for (int day = 0; day < 7; day++) {
+        if (len == 3 && strncmp(text, kDayNames[day], 3) == 0)
+            return day;
+    }
+    return -1;
+}
+
+
+// "mon-fri,sun"
+static bool
+libgtlm_schedule_parse_days(const char *text, uint8_t *days)
+{
+    *days = 0;
+    while (*text) {
+        size_t len = strcspn(text, ",");
+        const char *dash = (const char*)memchr(text, '-', len);
+        int first = libgtlm_schedule_parse_day(text, dash ? dash - text : len);
+        int last = dash ? libgtlm_schedule_parse_day(dash + 1,
+            len - (dash - text) - 1) : first;
+        if (first < 0 || last < 0)
+            return false;
+        for (int day = first; ; day = (day + 1) % 7) {
+            *days |= 1 << day;
+            if (day == last)
+                break;
+        }
+        text += len;
+        if (*text == ',')
+            text++;
+    }
+    return true;
+}
+
+
+static bool
+libgtlm_schedule_parse_rule(config_setting_t *setting,
+    libgtlm_schedule_rule *rule)
+{
+    static const struct { const char *name; uint8_t zone; } kZones[] = {
+        { "back", LEDS_BACK }, { "side", LEDS_SIDE }, { "front", LEDS_FRONT }
+    };
+    const char *text = NULL;
+    int value = 0;
+
+    memset(rule, 0, sizeof(*rule));
+    if (!config_setting_lookup_string(setting, "start", &text)
+        || !libgtlm_schedule_parse_time(text, &rule->start))
+        return false;
+    if (!config_setting_lookup_string(setting, "end", &text)
+        || !libgtlm_schedule_parse_time(text, &rule->end))
+        return false;
+    if (config_setting_lookup_string(setting, "days", &text)
+        && !libgtlm_schedule_parse_days(text, &rule->days))
+        return false;
+
+    for (size_t i = 0; i < sizeof(kZones) / sizeof(kZones[0]); i++) {
+        if (config_setting_lookup_bool(setting, kZones[i].name, &value)) {
+            rule->zones |= kZones[i].zone;
+            if (value)
+                rule->status |= kZones[i].zone;
+        }
+    }
+    if (config_setting_lookup_int(setting, "mode", &value)) {
+        if (value < MODE_BLINK || value > MODE_ALWAYS)
+            return false;
+        rule->has_mode = true;
+        rule->mode = value;
+    }
+    if (config_setting_lookup_bool(setting, "enabled", &value)) {
+        rule->has_enabled = true;
+        rule->enabled = value;
+    }
+    return true;
+}
+
+
+int
+libgtlm_schedule_load(libgtlm_schedule *schedule)
+{
+    if (schedule == NULL)
+        return -1;
+
+    libgtlm_device *device = schedule->device;
+    schedule->base.led_status = device->led_status;
+    schedule->base.led_mode = device->led_mode;
+    schedule->base.enabled = device->enabled;
+    // the fields were just read from the config, not from the controller
+    schedule->pending = true;
+    libgtlm_schedule_clear(schedule);
+
+    bool valid = true;
+    config_setting_t *settings = NULL, *rules = NULL;
+    settings = config_setting_get_member(config_root_setting(&device->config),
+        "settings");
+    if (settings)
+        rules = config_setting_get_member(settings, "schedule");
+    int count = rules ? config_setting_length(rules) : 0;
+    for (int i = 0; i < count; i++) {
+        libgtlm_schedule_rule rule;
+        if (!libgtlm_schedule_parse_rule(config_setting_get_elem(rules, i),
+            &rule)) {
+            GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_WARN,
+                "schedule: rule %d is malformed, skipped", i);
+            valid = false;
+        } else if (!libgtlm_schedule_add_rule(schedule, &rule))
+            valid = false;
+    }
+
+    libgtlm_schedule_update(schedule);
+    return valid ? schedule->rule_count : -1;
+}
+
+
+bool
+libgtlm_schedule_add_rule(libgtlm_schedule *schedule,
+    const libgtlm_schedule_rule *rule)
+{
+    if (schedule == NULL || rule == NULL
+        || schedule->rule_count == GTLM_SCHEDULE_MAX_RULES)
+        return false;
+
+    int index = schedule->rule_count++;
+    schedule->rules[index] = *rule;
+    for (int i = 0; i < 2; i++) {
+        libgtlm_wheel_timer *timer = &schedule->timers[index * 2 + i];
+        timer->rule = index;
+        timer->end = i == 1;
+        libgtlm_schedule_arm(schedule, timer, schedule->wheel.now);
+    }
+    return true;
+}
+
+
+void
+libgtlm_schedule_clear(libgtlm_schedule *schedule)
+{
+    if (schedule == NULL)
+        return;
+
+    for (int i = 0; i < schedule->rule_count * 2; i++)
+        libgtlm_wheel_remove(&schedule->wheel, &schedule->timers[i]);
+    schedule->rule_count = 0;
+}
+
+
+int
+libgtlm_schedule_update(libgtlm_schedule *schedule)
+{
+    if (schedule == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    libgtlm_device *device = schedule->device;
+    int result = LIBUSB_SUCCESS;
+    time_t now = time(NULL);
+    schedule->stats.wakeups++;
+
+    // a clock set back without cancelling the timer
+    if ((uint64_t)now < schedule->wheel.now)
+        libgtlm_schedule_rebuild(schedule, now);
+
+    libgtlm_wheel_timer *timer = libgtlm_wheel_advance(&schedule->wheel, now);
+    while (timer) {
+        libgtlm_wheel_timer *next = timer->next;
+        libgtlm_schedule_arm(schedule, timer, now);
+        timer = next;
+    }
+
+    libgtlm_frame frame = schedule->base;
+    struct tm local;
+    localtime_r(&now, &local);
+    for (int i = 0; i < schedule->rule_count; i++) {
+        const libgtlm_schedule_rule *rule = &schedule->rules[i];
+        if (!libgtlm_schedule_active(rule, &local))
+            continue;
+        frame.led_status = (frame.led_status & ~rule->zones)
+            | (rule->status & rule->zones);
+        if (rule->has_mode)
+            frame.led_mode = rule->mode;
+        if (rule->has_enabled)
+            frame.enabled = rule->enabled;
+    }
+
+    if (schedule->pending || frame.led_status != device->led_status
+        || frame.led_mode != device->led_mode
+        || frame.enabled != device->enabled) {
+        GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_INFO,
+            "schedule: zones 0x%02x, mode %d, %s", frame.led_status,
+            frame.led_mode, frame.enabled ? "enabled" : "disabled");
+        libgtlm_frame previous;
+        previous.led_status = device->led_status;
+        previous.led_mode = device->led_mode;
+        previous.enabled = device->enabled;
+        libgtlm_enable_led(device, (libgtlm_led_status)frame.led_status);
+        libgtlm_disable_led(device,
+            (libgtlm_led_status)(~frame.led_status & LEDS_ALL));
+        libgtlm_set_led_mode(device, (libgtlm_led_mode)frame.led_mode,
+            frame.enabled);
+        result = libgtlm_sync(device);
+        if (result == LIBUSB_SUCCESS) {
+            libgtlm_save_state(device);
+            schedule->pending = false;
+            schedule->stats.transitions++;
+        } else {
+            // keep the transition owed, so the retry below makes it
+            device->led_status = previous.led_status;
+            libgtlm_set_led_mode(device, (libgtlm_led_mode)previous.led_mode,
+                previous.enabled);
+            schedule->pending = true;
+            GTLM_LOG(SUBSYSTEM_SCHEDULER, LEVEL_WARN,
+                "schedule: sync failed, retrying in %d s",
+                GTLM_SCHEDULE_RETRY);
+        }
+    }
+
+    // absolute, so it also fires right after a resume that skipped past it
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    uint64_t next = libgtlm_wheel_next(&schedule->wheel);
+    if (schedule->pending && (uint64_t)now + GTLM_SCHEDULE_RETRY < next)
+        next = now + GTLM_SCHEDULE_RETRY;
+    if (next != GTLM_WHEEL_NONE)
+        spec.it_value.tv_sec = next;
+    timerfd_settime(schedule->timer_fd,
+        TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL);
+    return result;
+}
+
+
+uint64_t
+libgtlm_schedule_next(libgtlm_schedule *schedule)
+{
+    if (schedule == NULL)
+        return 0;
+
+    uint64_t next = libgtlm_wheel_next(&schedule->wheel);
+    return next == GTLM_WHEEL_NONE ? 0 : next;
+}
+
+
+void
+libgtlm_schedule_get_stats(libgtlm_schedule *schedule,
+    libgtlm_schedule_stats *stats)
+{
+    if (schedule == NULL || stats == NULL)
+        return;
+
+    *stats = schedule->stats;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_SCHEDULE_H__
+#define __LIBGTLM_SCHEDULE_H__
+
+#include "libgtlm.h"
+#include "libgtlm_loop.h"
+
+#define GTLM_SCHEDULE_MAX_RULES      32
+
+typedef struct libgtlm_schedule libgtlm_schedule;
+
+// Daily window in local time. One that ends before it starts runs past
+// midnight; equal times mean the whole day.
+typedef struct libgtlm_schedule_rule {
+    uint16_t start;             // minutes after midnight
+    uint16_t end;
+    uint8_t days;               // bit per tm_wday the window starts on, 0 = all
+    uint8_t zones;              // libgtlm_led_status bits the rule sets
+    uint8_t status;             // and their state
+    bool has_mode;
+    uint8_t mode;
+    bool has_enabled;
+    bool enabled;
+} libgtlm_schedule_rule;
+
+typedef struct libgtlm_schedule_stats {
+    uint64_t wakeups;
+    uint64_t transitions;       // wakeups that changed the device state
+    uint64_t clock_changes;     // wall clock set, wheel rebuilt
+} libgtlm_schedule_stats;
+
+// Time-of-day rules on top of the ~/.gtlm settings (Linux only):
+//
+//   settings = {
+//       front = true;
+//       ...
+//       schedule = (
+//           { start = "23:00"; end = "07:00"; front = false; },
+//           { start = "02:00"; end = "04:00"; days = "sat,sun"; mode = 3; }
+//       );
+//   };
+//
+// A rule may set back, side, front, mode and enabled; while several are
+// active the later one wins. The next start and end of every rule sit in a
+// hierarchical timer wheel, and a single absolute CLOCK_REALTIME timerfd on
+// the loop is armed for the earliest, so nothing runs between transitions.
+// Deadlines passed while suspended fire on resume; setting the clock
+// cancels the timer and the wheel is rebuilt. Transitions go through the
+// usual setters and libgtlm_sync, and are saved for libgtlm_restore; one
+// whose sync failed is retried a few seconds later.
+libgtlm_schedule* libgtlm_schedule_new(libgtlm_device *device,
+    libgtlm_loop *loop);
+void libgtlm_schedule_free(libgtlm_schedule *schedule);
+
+// Replaces the rules with the ones in the device config and takes the
+// current device state as the base they override, then applies them. The
+// result is synced even if it matches the device fields, which may only
+// hold what was read from the config.
+// Returns the number of rules, or -1 if one could not be parsed (the
+// others are still loaded).
+int libgtlm_schedule_load(libgtlm_schedule *schedule);
+bool libgtlm_schedule_add_rule(libgtlm_schedule *schedule,
+    const libgtlm_schedule_rule *rule);
+void libgtlm_schedule_clear(libgtlm_schedule *schedule);
+// Applies the rules for the current time and re-arms the timer.
+int libgtlm_schedule_update(libgtlm_schedule *schedule);
+// Next wakeup in seconds since the epoch, or 0 without rules. Usually a
+// transition; a rule more than a top-level wheel turn away is woken for
+// early once and re-queued.
+uint64_t libgtlm_schedule_next(libgtlm_schedule *schedule);
+void libgtlm_schedule_get_stats(libgtlm_schedule *schedule,
+    libgtlm_schedule_stats *stats);
+
+#endif // __LIBGTLM_SCHEDULE_H__
@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <new>
+#include <signal.h>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "libgtlm_shm.h"
+
+// a lock still odd after this many looks is taken to be held by a producer
+// that died inside a write
+#define GTLM_SHM_RETRIES             1000
+
+
+struct libgtlm_shm {
+    libgtlm_shm_segment *segment;
+    char *name;                 // set for the owner, which unlinks on close
+    uint64_t applied;
+    int event_fd;
+    std::thread watcher;
+    std::atomic<bool> watching;
+};
+
+
+static long
+libgtlm_futex(std::atomic<uint32_t> *word, int op, uint32_t value,
+    const struct timespec *timeout)
+{
+    // shared futex (no FUTEX_PRIVATE_FLAG): waiters live in other processes
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+
+// Gives 0 if the block stayed locked by another writer.
+static uint64_t
+libgtlm_block_write(libgtlm_shm_block *block, const libgtlm_frame *frame,
+    uint64_t sequence)
+{
+    uint32_t lock = block->lock.load(std::memory_order_relaxed);
+    for (int attempt = 0;; attempt++) {
+        if (attempt == GTLM_SHM_RETRIES)
+            return 0;
+        if (lock & 1) {
+            std::this_thread::yield();
+            lock = block->lock.load(std::memory_order_relaxed);
+        } else if (block->lock.compare_exchange_weak(lock, lock + 1,
+                std::memory_order_acquire, std::memory_order_relaxed))
+            break;
+    }
+    // the odd value must be visible before any of the fields change
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (sequence == 0)
+        sequence = block->sequence.load(std::memory_order_relaxed) + 1;
+    block->led_status.store(frame->led_status, std::memory_order_relaxed);
+    block->led_mode.store(frame->led_mode, std::memory_order_relaxed);
+    block->enabled.store(frame->enabled, std::memory_order_relaxed);
+    block->sequence.store(sequence, std::memory_order_relaxed);
+    block->lock.store(lock + 2, std::memory_order_release);
+    return sequence;
+}
+
+
+// False if no whole copy could be taken, i.e. the block stayed locked.
+static bool
+libgtlm_block_read(libgtlm_shm_block *block, libgtlm_frame *frame,
+    uint64_t *sequence)
+{
+    for (int attempt = 0; attempt < GTLM_SHM_RETRIES; attempt++) {
+        uint32_t before = block->lock.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        libgtlm_frame copy;
+        copy.led_status = block->led_status.load(std::memory_order_relaxed);
+        copy.led_mode = block->led_mode.load(std::memory_order_relaxed);
+        copy.enabled = block->enabled.load(std::memory_order_relaxed) != 0;
+        uint64_t value = block->sequence.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (block->lock.load(std::memory_order_relaxed) != before)
+            continue;
+
+        if (frame)
+            *frame = copy;
+        *sequence = value;
+        return true;
+    }
+    return false;
+}
+
+
+// Unlocks a block that a producer left odd by dying inside a write.
+// Its fields may mix two frames, but the sequence, stored last, was only
+// bumped if the new frame was complete.
+static void
+libgtlm_block_recover(libgtlm_shm_block *block)
+{
+    uint32_t lock = block->lock.load(std::memory_order_relaxed);
+    if ((lock & 1) && block->lock.compare_exchange_strong(lock, lock + 1,
+            std::memory_order_release, std::memory_order_relaxed))
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_WARN,
+            "shm: recovered a block left locked by a dead producer");
+}
+
+
+static libgtlm_shm*
+libgtlm_shm_map(int fd)
+{
+    void *memory = mmap(NULL, sizeof(libgtlm_shm_segment),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return NULL;
+
+    libgtlm_shm *shm = new libgtlm_shm;
+    shm->segment = (libgtlm_shm_segment*)memory;
+    shm->name = NULL;
+    shm->applied = 0;
+    shm->event_fd = -1;
+    shm->watching = false;
+    return shm;
+}
+
+
+// An existing segment may be replaced if it cannot be used anyway or its
+// owner is gone, both of which libgtlm_shm_open refuses; a pid that was
+// reused keeps it, which errs on the safe side.
+static bool
+libgtlm_shm_stale(const char *name)
+{
+    errno = 0;
+    libgtlm_shm *shm = libgtlm_shm_open(name);
+    if (shm == NULL)
+        return errno != EACCES;
+
+    libgtlm_shm_close(shm);
+    return false;
+}
+
+
+libgtlm_shm*
+libgtlm_shm_create(const char *name, int mode)
+{
+    if (name == NULL)
+        name = GTLM_SHM_NAME;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (fd < 0 && errno == EEXIST) {
+        if (!libgtlm_shm_stale(name)) {
+            errno = EEXIST;
+            return NULL;
+        }
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_WARN,
+            "shm: replacing stale segment %s", name);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    }
+    if (fd < 0)
+        return NULL;
+
+    // the umask applies to shm_open; producers may run as other users
+    if (fchmod(fd, mode) < 0
+        || ftruncate(fd, sizeof(libgtlm_shm_segment)) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    libgtlm_shm *shm = libgtlm_shm_map(fd);
+    if (shm == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    libgtlm_shm_segment *segment = new (shm->segment) libgtlm_shm_segment();
+    segment->magic = GTLM_SHM_MAGIC;
+    segment->version = GTLM_SHM_VERSION;
+    segment->owner = getpid();
+    shm->name = strdup(name);
+    return shm;
+}
+
+
+libgtlm_shm*
+libgtlm_shm_open(const char *name)
+{
+    if (name == NULL)
+        name = GTLM_SHM_NAME;
+
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0
+        || info.st_size < (off_t)sizeof(libgtlm_shm_segment)) {
+        close(fd);
+        return NULL;
+    }
+
+    libgtlm_shm *shm = libgtlm_shm_map(fd);
+    if (shm && (shm->segment->magic != GTLM_SHM_MAGIC
+            || shm->segment->version != GTLM_SHM_VERSION)) {
+        libgtlm_shm_close(shm);
+        return NULL;
+    }
+    // nobody would sync what is written into a dead owner's segment
+    pid_t owner = shm ? shm->segment->owner : 0;
+    if (shm && (owner <= 0 || (kill(owner, 0) < 0 && errno == ESRCH))) {
+        libgtlm_shm_close(shm);
+        errno = ESRCH;
+        return NULL;
+    }
+    return shm;
+}
+
+
+static void
+libgtlm_shm_wake(libgtlm_shm *shm)
+{
+    shm->segment->wake.fetch_add(1);
+    if (shm->segment->waiters.load() != 0)
+        libgtlm_futex(&shm->segment->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+
+void
+libgtlm_shm_close(libgtlm_shm *shm)
+{
+    if (shm == NULL)
+        return;
+
+    if (shm->watching) {
+        shm->watching = false;
+        libgtlm_shm_wake(shm);
+        shm->watcher.join();
+        close(shm->event_fd);
+    }
+    munmap(shm->segment, sizeof(libgtlm_shm_segment));
+    if (shm->name) {
+        shm_unlink(shm->name);
+        free(shm->name);
+    }
+    delete shm;
+}
+
+
+uint64_t
+libgtlm_shm_write(libgtlm_shm *shm, const libgtlm_frame *frame)
+{
+    if (shm == NULL || frame == NULL)
+        return 0;
+
+    libgtlm_shm_block *desired = &shm->segment->desired;
+    uint64_t sequence = libgtlm_block_write(desired, frame, 0);
+    if (sequence == 0) {
+        libgtlm_block_recover(desired);
+        sequence = libgtlm_block_write(desired, frame, 0);
+        if (sequence == 0)
+            return 0;
+    }
+    libgtlm_shm_wake(shm);
+    return sequence;
+}
+
+
+uint64_t
+libgtlm_shm_read_desired(libgtlm_shm *shm, libgtlm_frame *frame)
+{
+    uint64_t sequence;
+    if (shm == NULL
+        || !libgtlm_block_read(&shm->segment->desired, frame, &sequence))
+        return 0;
+    return sequence;
+}
+
+
+uint64_t
+libgtlm_shm_read_confirmed(libgtlm_shm *shm, libgtlm_frame *frame)
+{
+    uint64_t sequence;
+    if (shm == NULL
+        || !libgtlm_block_read(&shm->segment->confirmed, frame, &sequence))
+        return 0;
+    return sequence;
+}
+
+
+bool
+libgtlm_shm_wait(libgtlm_shm *shm, uint64_t seen, int timeout)
+{
+    if (shm == NULL)
+        return false;
+
+    libgtlm_shm_segment *segment = shm->segment;
+    uint64_t deadline = timeout < 0 ? 0
+        : libgtlm_time_ns() + (uint64_t)timeout * 1000000;
+    bool changed = false;
+
+    // Producers bump the sequence, then the wake word, then look at
+    // waiters; registering first and re-checking the sequence closes the
+    // window in which a write could go unnoticed.
+    segment->waiters.fetch_add(1);
+    for (;;) {
+        uint32_t wake = segment->wake.load();
+        if (segment->desired.sequence.load() != seen) {
+            changed = true;
+            break;
+        }
+
+        struct timespec remaining;
+        struct timespec *limit = NULL;
+        if (timeout >= 0) {
+            uint64_t now = libgtlm_time_ns();
+            if (now >= deadline)
+                break;
+            remaining.tv_sec = (deadline - now) / 1000000000ULL;
+            remaining.tv_nsec = (deadline - now) % 1000000000ULL;
+            limit = &remaining;
+        }
+        // libgtlm_shm_close() wakes the eventfd watcher to stop it
+        if (!shm->watching && shm->event_fd >= 0)
+            break;
+        if (libgtlm_futex(&segment->wake, FUTEX_WAIT, wake, limit) < 0
+            && errno == ETIMEDOUT)
+            break;
+    }
+    segment->waiters.fetch_sub(1);
+    return changed;
+}
+
+
+int
+libgtlm_shm_apply(libgtlm_shm *shm, libgtlm_device *device)
+{
+    if (shm == NULL || device == NULL)
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    libgtlm_frame frame;
+    uint64_t sequence;
+    if (!libgtlm_block_read(&shm->segment->desired, &frame, &sequence)) {
+        libgtlm_block_recover(&shm->segment->desired);
+        if (!libgtlm_block_read(&shm->segment->desired, &frame, &sequence))
+            return LIBUSB_ERROR_BUSY;
+    }
+    if (sequence == shm->applied)
+        return LIBUSB_SUCCESS;
+
+    // libgtlm_sync publishes the confirmed state under this sequence
+    uint64_t applied = shm->applied;
+    shm->applied = sequence;
+    device->led_status = frame.led_status;
+    libgtlm_set_led_mode(device, (libgtlm_led_mode)frame.led_mode,
+        frame.enabled);
+    int result = libgtlm_sync(device);
+    if (result < 0) {
+        // try this frame again next time
+        shm->applied = applied;
+        return result;
+    }
+
+    return LIBUSB_SUCCESS;
+}
+
+
+void
+libgtlm_shm_attach(libgtlm_shm *shm, libgtlm_device *device)
+{
+    if (device == NULL)
+        return;
+
+    device->shm = shm;
+    if (shm == NULL || shm->name == NULL)
+        return;
+
+    // producers start from the state the owner has now
+    libgtlm_frame frame;
+    frame.led_status = device->led_status;
+    frame.led_mode = device->led_mode;
+    frame.enabled = device->enabled;
+    uint64_t sequence = libgtlm_block_write(&shm->segment->desired, &frame, 0);
+    if (sequence != 0)
+        shm->applied = sequence;
+    libgtlm_shm_publish(shm, device);
+}
+
+
+void
+libgtlm_shm_publish(libgtlm_shm *shm, libgtlm_device *device)
+{
+    if (shm == NULL || device == NULL || shm->name == NULL)
+        return;
+
+    libgtlm_frame frame;
+    frame.led_status = device->led_status;
+    frame.led_mode = device->led_mode;
+    frame.enabled = device->enabled;
+    libgtlm_block_write(&shm->segment->confirmed, &frame, shm->applied);
+}
+
+
+// Starts from the last applied sequence so writes that landed before the
+// eventfd existed are still signalled.
+static void
+libgtlm_shm_watch(libgtlm_shm *shm, uint64_t seen)
+{
+    while (shm->watching) {
+        if (libgtlm_shm_wait(shm, seen, -1)) {
+            seen = shm->segment->desired.sequence.load();
+            uint64_t one = 1;
+            if (write(shm->event_fd, &one, sizeof(one)) < 0)
+                break;
+        }
+    }
+}
+
+
+int
+libgtlm_shm_get_eventfd(libgtlm_shm *shm)
+{
+    if (shm == NULL)
+        return -1;
+
+    if (shm->event_fd < 0) {
+        shm->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shm->event_fd < 0)
+            return -1;
+        shm->watching = true;
+        shm->watcher = std::thread(libgtlm_shm_watch, shm, shm->applied);
+    }
+    return shm->event_fd;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_SHM_H__
+#define __LIBGTLM_SHM_H__
+
+#include <atomic>
+#include "libgtlm.h"
+
+#define GTLM_SHM_NAME                "/gtlm"
+#define GTLM_SHM_MAGIC               0x4d4c5447     // "GTLM"
+#define GTLM_SHM_VERSION             2
+#define GTLM_SHM_RETRY               1000           // ms, failed frames
+
+// One seqlock-protected copy of the state. The lock is odd while a writer
+// is inside; readers retry, a bounded number of times, until they see the
+// same even value on both sides of their copy.
+typedef struct alignas(64) libgtlm_shm_block {
+    std::atomic<uint32_t> lock;
+    std::atomic<uint8_t> led_status;
+    std::atomic<uint8_t> led_mode;
+    std::atomic<uint8_t> enabled;
+    std::atomic<uint64_t> sequence;
+} libgtlm_shm_block;
+
+// Layout of the POSIX shared memory segment.
+typedef struct libgtlm_shm_segment {
+    uint32_t magic;
+    uint32_t version;
+    int32_t owner;                  // pid of the creator
+    libgtlm_shm_block desired;      // written by producers
+    libgtlm_shm_block confirmed;    // written by the device owner after sync
+    alignas(64) std::atomic<uint32_t> wake;     // futex word
+    std::atomic<uint32_t> waiters;
+} libgtlm_shm_segment;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free
+    && std::atomic<uint32_t>::is_always_lock_free,
+    "shared state needs address-free atomics");
+
+typedef struct libgtlm_shm libgtlm_shm;
+
+// Cross-process state exchange without IPC calls (Linux only). The process
+// owning the libgtlm_device creates the segment; producers open it, write
+// the desired frame and wake the owner only if it is asleep. The owner
+// syncs the newest desired frame, and once attached publishes the device's
+// reply to every sync, its own included, as the confirmed state, which
+// anyone can read directly. Creating fails with
+// EEXIST while the owner of an existing segment is alive; one left behind
+// by a dead owner, or with another layout, is replaced. Opening fails
+// with ESRCH once the owner is gone.
+libgtlm_shm* libgtlm_shm_create(const char *name, int mode);
+libgtlm_shm* libgtlm_shm_open(const char *name);
+void libgtlm_shm_close(libgtlm_shm *shm);
+
+// producers: sequences start at 1; 0 means the block stayed locked, even
+// after taking over a lock left by a producer that died inside a write.
+uint64_t libgtlm_shm_write(libgtlm_shm *shm, const libgtlm_frame *frame);
+uint64_t libgtlm_shm_read_desired(libgtlm_shm *shm, libgtlm_frame *frame);
+uint64_t libgtlm_shm_read_confirmed(libgtlm_shm *shm, libgtlm_frame *frame);
+
+// owner: blocks until the desired sequence moves past seen (timeout in ms,
+// -1 = forever); true if it did.
+bool libgtlm_shm_wait(libgtlm_shm *shm, uint64_t seen, int timeout);
+// owner: syncs the latest desired frame if it is newer than the last one
+// applied; a failed sync leaves it to be applied again.
+int libgtlm_shm_apply(libgtlm_shm *shm, libgtlm_device *device);
+// owner: seeds the desired and confirmed state from the device, then lets
+// every libgtlm_sync that read the device back publish the confirmed
+// state: always in SYNC_CONFIRMED, in SYNC_FIRE_AND_FORGET only when the
+// sync verified, so there confirmed may trail desired. NULL detaches.
+void libgtlm_shm_attach(libgtlm_shm *shm, libgtlm_device *device);
+// Called by libgtlm_sync; tagged with the last applied desired sequence.
+void libgtlm_shm_publish(libgtlm_shm *shm, libgtlm_device *device);
+// owner: an eventfd that becomes readable when producers write, for use
+// with libgtlm_loop; backed by a thread sleeping on the futex.
+int libgtlm_shm_get_eventfd(libgtlm_shm *shm);
+
+#endif // __LIBGTLM_SHM_H__
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "libgtlm_sim.h"
+
+// used until a profile says otherwise, in microseconds
+#define GTLM_SIM_DEFAULT_LATENCY     2000
+#define GTLM_SIM_DEFAULT_OUT_SHARE   50
+
+// captured round trips this many times the median count as stalls
+#define GTLM_SIM_STALL_FACTOR        8
+
+static const char *kSimCommandNames[CMD_COUNT] = {
+    "set_led_status",
+    "set_led_mode",
+    "get_version",
+    "get_led_mode",
+};
+
+
+struct libgtlm_sim {
+    libgtlm_transport transport;
+    libgtlm_packet request;
+    libgtlm_packet reply;
+    std::mutex lock;
+    std::vector<uint32_t> latency[CMD_COUNT];
+    uint32_t out_share;
+    uint32_t stall_rate;
+    uint32_t stall_time;
+    uint32_t drop_rate;
+    libgtlm_sim_readback readback;
+    uint64_t random;
+    bool virtual_clock;
+    std::atomic<uint64_t> now;
+    libgtlm_frame state;
+    libgtlm_sim_stats stats;
+};
+
+
+// xorshift64*
+static uint64_t
+libgtlm_sim_random(libgtlm_sim *sim)
+{
+    sim->random ^= sim->random >> 12;
+    sim->random ^= sim->random << 25;
+    sim->random ^= sim->random >> 27;
+    return sim->random * 0x2545F4914F6CDD1DULL;
+}
+
+
+static bool
+libgtlm_sim_chance(libgtlm_sim *sim, uint32_t perMillion)
+{
+    return perMillion != 0 && libgtlm_sim_random(sim) % 1000000 < perMillion;
+}
+
+
+static uint64_t
+libgtlm_sim_cost(libgtlm_sim *sim, libgtlm_command command, bool readBack)
+{
+    const std::vector<uint32_t> &samples = sim->latency[command];
+    uint64_t cost = (uint64_t)samples[libgtlm_sim_random(sim) % samples.size()]
+        * 1000;
+    if (!readBack)
+        cost = cost * sim->out_share / 100;
+    if (libgtlm_sim_chance(sim, sim->stall_rate)) {
+        cost += (uint64_t)sim->stall_time * 1000;
+        sim->stats.stalls++;
+    }
+    return cost;
+}
+
+
+static void
+libgtlm_sim_apply(libgtlm_sim *sim, libgtlm_command command)
+{
+    const libgtlm_command_layout &layout = kLibgtlmCommands[command];
+    if (command == CMD_SET_LED_STATUS)
+        sim->state.led_status = sim->request.data[layout.arg0] & LEDS_ALL;
+    else if (command == CMD_SET_LED_MODE) {
+        sim->state.led_mode = sim->request.data[layout.arg0];
+        sim->state.enabled = sim->request.data[layout.arg1] != 0;
+    }
+}
+
+
+static void
+libgtlm_sim_answer(libgtlm_sim *sim, libgtlm_command command,
+    const libgtlm_frame *state)
+{
+    memset(&sim->reply, 0x00, sizeof(sim->reply));
+    if (command == CMD_SET_LED_STATUS)
+        sim->reply.data[GTLM_REPLY_LED_STATUS] = state->led_status;
+    else if (command == CMD_GET_VERSION)
+        memcpy(&sim->reply.data[GTLM_REPLY_VERSION], GTLM_VERSION_STRING,
+            GTLM_REPLY_VERSION_SIZE);
+    else {
+        sim->reply.data[GTLM_REPLY_LED_MODE] = state->led_mode;
+        sim->reply.data[GTLM_REPLY_ENABLED] = state->enabled ? 1 : 0;
+    }
+}
+
+
+static int
+libgtlm_sim_transfer(libgtlm_transport *transport, bool readBack)
+{
+    libgtlm_sim *sim = (libgtlm_sim*)transport;
+    uint64_t cost = 0;
+    {
+        std::lock_guard<std::mutex> lock(sim->lock);
+        // the controller stalls requests it does not know
+        libgtlm_command command = libgtlm_decode(sim->request);
+        if (command == CMD_COUNT)
+            return LIBUSB_ERROR_PIPE;
+
+        cost = libgtlm_sim_cost(sim, command, readBack);
+        libgtlm_frame previous = sim->state;
+        if (libgtlm_sim_chance(sim, sim->drop_rate))
+            sim->stats.dropped++;
+        else
+            libgtlm_sim_apply(sim, command);
+        if (readBack)
+            libgtlm_sim_answer(sim, command,
+                sim->readback == SIM_READBACK_STALE ? &previous : &sim->state);
+
+        sim->stats.requests[command]++;
+        sim->stats.busy_time += cost;
+        if (sim->virtual_clock)
+            sim->now.fetch_add(cost, std::memory_order_relaxed);
+    }
+
+    if (!sim->virtual_clock)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(cost));
+    return GTLM_PACKET_SIZE;
+}
+
+
+static uint64_t
+libgtlm_sim_clock(void *data)
+{
+    return ((libgtlm_sim*)data)->now.load(std::memory_order_relaxed);
+}
+
+
+libgtlm_sim*
+libgtlm_sim_new(uint64_t seed)
+{
+    libgtlm_sim *sim = new libgtlm_sim;
+    sim->transport.request = &sim->request;
+    sim->transport.reply = &sim->reply;
+    sim->transport.transfer = libgtlm_sim_transfer;
+    memset(&sim->request, 0x00, sizeof(sim->request));
+    memset(&sim->reply, 0x00, sizeof(sim->reply));
+    for (int i = 0; i < CMD_COUNT; i++)
+        sim->latency[i].assign(1, GTLM_SIM_DEFAULT_LATENCY);
+    sim->out_share = GTLM_SIM_DEFAULT_OUT_SHARE;
+    sim->stall_rate = 0;
+    sim->stall_time = 0;
+    sim->drop_rate = 0;
+    sim->readback = SIM_READBACK_ECHO;
+    // xorshift must not start from zero
+    sim->random = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    sim->virtual_clock = false;
+    sim->now = 0;
+    sim->state.led_status = GTLM_POWER_ON_STATUS;
+    sim->state.led_mode = GTLM_POWER_ON_MODE;
+    sim->state.enabled = GTLM_POWER_ON_ENABLED;
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    return sim;
+}
+
+
+void
+libgtlm_sim_free(libgtlm_sim *sim)
+{
+    if (sim == NULL)
+        return;
+
+    if (sim->virtual_clock)
+        libgtlm_set_clock(NULL, NULL);
+    delete sim;
+}
+
+
+libgtlm_transport*
+libgtlm_sim_get_transport(libgtlm_sim *sim)
+{
+    return sim ? &sim->transport : NULL;
+}
+
+
+bool
+libgtlm_sim_load_profile(libgtlm_sim *sim, const char *path)
+{
+    if (sim == NULL || path == NULL)
+        return false;
+
+    config_t config;
+    config_init(&config);
+    if (config_read_file(&config, path) != CONFIG_TRUE) {
+        config_destroy(&config);
+        return false;
+    }
+
+    config_setting_t *profile = config_setting_get_member(
+        config_root_setting(&config), "profile");
+    if (profile == NULL) {
+        config_destroy(&config);
+        return false;
+    }
+
+    std::vector<uint32_t> samples;
+    for (int i = 0; i < CMD_COUNT; i++) {
+        config_setting_t *setting =
+            config_setting_get_member(profile, kSimCommandNames[i]);
+        if (setting == NULL)
+            continue;
+        samples.clear();
+        for (int j = 0; j < config_setting_length(setting); j++) {
+            int sample = config_setting_get_int_elem(setting, j);
+            if (sample > 0)
+                samples.push_back(sample);
+        }
+        libgtlm_sim_set_latency(sim, (libgtlm_command)i, samples.data(),
+            samples.size());
+    }
+
+    int value = 0;
+    const char *readback = NULL;
+    std::lock_guard<std::mutex> lock(sim->lock);
+    if (config_setting_lookup_int(profile, "out_share", &value)
+        && value > 0 && value <= 100)
+        sim->out_share = value;
+    if (config_setting_lookup_int(profile, "stall_rate", &value) && value >= 0)
+        sim->stall_rate = value;
+    if (config_setting_lookup_int(profile, "stall_time", &value) && value >= 0)
+        sim->stall_time = value;
+    if (config_setting_lookup_int(profile, "drop_rate", &value) && value >= 0)
+        sim->drop_rate = value;
+    if (config_setting_lookup_string(profile, "readback", &readback))
+        sim->readback = strcmp(readback, "stale") == 0 ? SIM_READBACK_STALE
+            : SIM_READBACK_ECHO;
+
+    config_destroy(&config);
+    return true;
+}
+
+
+static uint64_t
+libgtlm_sim_time(libgtlm_transport *transport, bool readBack)
+{
+    uint64_t start = libgtlm_time_ns();
+    if (transport->transfer(transport, readBack) < 0)
+        return 0;
+    return libgtlm_time_ns() - start;
+}
+
+
+static config_setting_t*
+libgtlm_sim_add_int(config_setting_t *group, const char *name, int value)
+{
+    config_setting_t *setting = config_setting_add(group, name,
+        CONFIG_TYPE_INT);
+    if (setting)
+        config_setting_set_int(setting, value);
+    return setting;
+}
+
+
+bool
+libgtlm_sim_capture_profile(libgtlm_device *device, uint32_t samples,
+    const char *path)
+{
+    if (device == NULL || samples == 0 || path == NULL)
+        return false;
+
+    // re-send the controller's own mode rather than one a config filled in
+    if (libgtlm_get_led_mode(device) < 0)
+        return false;
+
+    libgtlm_transport *transport = device->transport;
+    std::vector<uint32_t> latency[CMD_COUNT];
+    uint64_t outTotal = 0;
+    uint64_t roundTotal = 0;
+    uint64_t stallTotal = 0;
+    uint64_t stalls = 0;
+    uint64_t transfers = 0;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        for (int command = 0; command < CMD_COUNT; command++) {
+            libgtlm_packet *request = transport->request;
+            if (command == CMD_SET_LED_STATUS)
+                *request = libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+            else if (command == CMD_SET_LED_MODE)
+                *request = libgtlm_encode<CMD_SET_LED_MODE>(device->led_mode,
+                    device->enabled);
+            else if (command == CMD_GET_VERSION)
+                *request = libgtlm_encode<CMD_GET_VERSION>();
+            else
+                *request = libgtlm_encode<CMD_GET_LED_MODE>();
+
+            uint64_t time = libgtlm_sim_time(transport, true);
+            if (time == 0)
+                return false;
+            latency[command].push_back(std::max<uint64_t>(time / 1000, 1));
+            transfers++;
+            if (command == CMD_SET_LED_STATUS)
+                roundTotal += time;
+        }
+
+        *transport->request =
+            libgtlm_encode<CMD_SET_LED_STATUS>(device->led_status);
+        uint64_t time = libgtlm_sim_time(transport, false);
+        if (time == 0)
+            return false;
+        outTotal += time;
+    }
+
+    // Rare outliers would be over-represented in a short capture; pull
+    // them out of the samples and describe them as a stall rate instead.
+    for (int command = 0; command < CMD_COUNT; command++) {
+        std::vector<uint32_t> &list = latency[command];
+        std::vector<uint32_t> sorted = list;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+            sorted.end());
+        uint64_t limit = (uint64_t)sorted[sorted.size() / 2]
+            * GTLM_SIM_STALL_FACTOR;
+        for (size_t i = 0; i < list.size(); ) {
+            if (list[i] > limit) {
+                stallTotal += list[i];
+                stalls++;
+                list[i] = list.back();
+                list.pop_back();
+            } else
+                i++;
+        }
+    }
+
+    config_t config;
+    config_init(&config);
+    config_setting_t *profile = config_setting_add(
+        config_root_setting(&config), "profile", CONFIG_TYPE_GROUP);
+    for (int command = 0; profile && command < CMD_COUNT; command++) {
+        config_setting_t *setting = config_setting_add(profile,
+            kSimCommandNames[command], CONFIG_TYPE_ARRAY);
+        for (size_t i = 0; setting && i < latency[command].size(); i++)
+            config_setting_set_int_elem(setting, -1, latency[command][i]);
+    }
+
+    int outShare = roundTotal ? (int)(outTotal * 100 / roundTotal) : 0;
+    libgtlm_sim_add_int(profile, "out_share",
+        std::min(std::max(outShare, 1), 100));
+    libgtlm_sim_add_int(profile, "stall_rate",
+        (int)(stalls * 1000000 / transfers));
+    libgtlm_sim_add_int(profile, "stall_time",
+        stalls ? (int)(stallTotal / stalls) : 0);
+    libgtlm_sim_add_int(profile, "drop_rate", 0);
+    config_setting_t *setting = config_setting_add(profile, "readback",
+        CONFIG_TYPE_STRING);
+    if (setting)
+        config_setting_set_string(setting, "echo");
+
+    bool written = config_write_file(&config, path) == CONFIG_TRUE;
+    config_destroy(&config);
+    return written;
+}
+
+
+void
+libgtlm_sim_set_latency(libgtlm_sim *sim, libgtlm_command command,
+    const uint32_t *samples, uint32_t count)
+{
+    if (sim == NULL || command >= CMD_COUNT || samples == NULL || count == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    sim->latency[command].assign(samples, samples + count);
+}
+
+
+void
+libgtlm_sim_set_stalls(libgtlm_sim *sim, uint32_t rate, uint32_t time)
+{
+    if (sim == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    sim->stall_rate = rate;
+    sim->stall_time = time;
+}
+
+
+void
+libgtlm_sim_set_drops(libgtlm_sim *sim, uint32_t rate)
+{
+    if (sim == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    sim->drop_rate = rate;
+}
+
+
+void
+libgtlm_sim_set_readback(libgtlm_sim *sim, libgtlm_sim_readback readback)
+{
+    if (sim == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    sim->readback = readback;
+}
+
+
+void
+libgtlm_sim_set_virtual_clock(libgtlm_sim *sim, bool enable)
+{
+    if (sim == NULL)
+        return;
+
+    sim->virtual_clock = enable;
+    if (enable)
+        libgtlm_set_clock(libgtlm_sim_clock, sim);
+    else
+        libgtlm_set_clock(NULL, NULL);
+}
+
+
+void
+libgtlm_sim_advance(libgtlm_sim *sim, uint64_t ns)
+{
+    if (sim == NULL)
+        return;
+
+    sim->now.fetch_add(ns, std::memory_order_relaxed);
+}
+
+
+uint64_t
+libgtlm_sim_now(libgtlm_sim *sim)
+{
+    return sim ? libgtlm_sim_clock(sim) : 0;
+}
+
+
+void
+libgtlm_sim_get_state(libgtlm_sim *sim, libgtlm_frame *frame)
+{
+    if (sim == NULL || frame == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    *frame = sim->state;
+}
+
+
+void
+libgtlm_sim_get_stats(libgtlm_sim *sim, libgtlm_sim_stats *stats)
+{
+    if (sim == NULL || stats == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(sim->lock);
+    *stats = sim->stats;
+}
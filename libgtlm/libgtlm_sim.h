@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_SIM_H__
+#define __LIBGTLM_SIM_H__
+
+#include "libgtlm.h"
+
+typedef struct libgtlm_sim libgtlm_sim;
+
+// SIM_READBACK_ECHO answers with the state a request produced,
+// SIM_READBACK_STALE with the state from before it.
+enum libgtlm_sim_readback {
+    SIM_READBACK_ECHO   = 0,
+    SIM_READBACK_STALE  = 1
+};
+
+typedef struct libgtlm_sim_stats {
+    uint64_t requests[CMD_COUNT];
+    uint64_t stalls;
+    uint64_t dropped;           // OUT packets the controller ignored
+    uint64_t busy_time;         // simulated bus time, ns
+} libgtlm_sim_stats;
+
+// Simulated 0x1770:0xFF00 controller, attached with libgtlm_open_transport().
+// Each transfer takes a latency drawn from the profile's samples for its
+// command (OUT-only sends take out_share percent of it) plus an occasional
+// stall, and the controller state follows the requests it is sent. Draws
+// come from a seeded generator, so runs are reproducible.
+//
+// With the virtual clock on, transfers advance simulated time instead of
+// sleeping and libgtlm_time_ns() reads that time. Threads that sleep until
+// a deadline (libgtlm_pwm, libgtlm_pacer) wait out the virtual time left
+// on the real clock, so they keep their pacing but gain no speed-up.
+libgtlm_sim* libgtlm_sim_new(uint64_t seed);
+void libgtlm_sim_free(libgtlm_sim *sim);
+libgtlm_transport* libgtlm_sim_get_transport(libgtlm_sim *sim);
+
+// Profile settings, all optional; times are in microseconds:
+//
+//   profile = {
+//       set_led_status = [ 1990, 2004, 1987 ];  // OUT+IN round trips
+//       set_led_mode = [ ... ];
+//       get_version = [ ... ];
+//       get_led_mode = [ ... ];
+//       out_share = 50;        // percent of a round trip taken by OUT
+//       stall_rate = 20;       // per million transfers
+//       stall_time = 25000;
+//       drop_rate = 0;         // per million OUT packets
+//       readback = "echo";     // or "stale"
+//   };
+bool libgtlm_sim_load_profile(libgtlm_sim *sim, const char *path);
+// Times samples round trips of every command and as many OUT-only sends on
+// a real controller and writes them as a profile. Requests re-send the mode
+// read back from the controller and the device's led_status, which the
+// controller cannot report; the caller sets that to what the LEDs show.
+bool libgtlm_sim_capture_profile(libgtlm_device *device, uint32_t samples,
+    const char *path);
+void libgtlm_sim_set_latency(libgtlm_sim *sim, libgtlm_command command,
+    const uint32_t *samples, uint32_t count);
+void libgtlm_sim_set_stalls(libgtlm_sim *sim, uint32_t rate, uint32_t time);
+void libgtlm_sim_set_drops(libgtlm_sim *sim, uint32_t rate);
+void libgtlm_sim_set_readback(libgtlm_sim *sim, libgtlm_sim_readback readback);
+
+void libgtlm_sim_set_virtual_clock(libgtlm_sim *sim, bool enable);
+void libgtlm_sim_advance(libgtlm_sim *sim, uint64_t ns);
+uint64_t libgtlm_sim_now(libgtlm_sim *sim);
+
+// What the LEDs currently show.
+void libgtlm_sim_get_state(libgtlm_sim *sim, libgtlm_frame *frame);
+void libgtlm_sim_get_stats(libgtlm_sim *sim, libgtlm_sim_stats *stats);
+
+#endif // __LIBGTLM_SIM_H__
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include "libgtlm_sysfs.h"
+
+static const char *gSysfsRoot = "/";
+
+
+// Reads a short attribute into buffer, without the trailing newline.
+static bool
+libgtlm_sysfs_read(int dir, const char *name, char *buffer, size_t size)
+{
+    int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length <= 0)
+        return false;
+
+    while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == ' '))
+        length--;
+    buffer[length] = '\0';
+    return true;
+}
+
+
+static bool
+libgtlm_sysfs_match_entry(int devices, const char *name,
+    libgtlm_sysfs_match *match)
+{
+    // interfaces ("1-4:1.0") carry no device ids
+    if (name[0] == '.' || strchr(name, ':') != NULL
+        || strlen(name) >= sizeof(match->name))
+        return false;
+
+    int dir = openat(devices, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0)
+        return false;
+
+    char vendor[8], product[8], bus[8], address[8];
+    bool found = false;
+    if (libgtlm_sysfs_read(dir, "idVendor", vendor, sizeof(vendor))
+        && libgtlm_sysfs_read(dir, "idProduct", product, sizeof(product))) {
+        const libgtlm_device_id *id = libgtlm_find_device_id(
+            strtoul(vendor, NULL, 16), strtoul(product, NULL, 16));
+        if (id && libgtlm_sysfs_read(dir, "busnum", bus, sizeof(bus))
+            && libgtlm_sysfs_read(dir, "devnum", address, sizeof(address))) {
+            match->id = id;
+            strcpy(match->name, name);
+            snprintf(match->node, sizeof(match->node), "dev/bus/usb/%03lu/%03lu",
+                strtoul(bus, NULL, 10), strtoul(address, NULL, 10));
+            found = true;
+        }
+    }
+    close(dir);
+    return found;
+}
+
+
+void
+libgtlm_set_sysfs_root(const char *root)
+{
+    gSysfsRoot = root ? root : "/";
+}
+
+
+bool
+libgtlm_sysfs_find(const char *hint, libgtlm_sysfs_match *match)
+{
+    if (match == NULL)
+        return false;
+
+    int rootDir = open(gSysfsRoot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootDir < 0)
+        return false;
+    int devices = openat(rootDir, "sys/bus/usb/devices",
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(rootDir);
+    if (devices < 0)
+        return false;
+
+    bool found = hint && hint[0] && libgtlm_sysfs_match_entry(devices, hint,
+        match);
+    if (!found) {
+        // fdopendir() takes over the descriptor
+        DIR *dir = fdopendir(dup(devices));
+        if (dir) {
+            struct dirent *entry;
+            while (!found && (entry = readdir(dir)) != NULL)
+                found = libgtlm_sysfs_match_entry(devices, entry->d_name,
+                    match);
+            closedir(dir);
+        }
+    }
+
+    close(devices);
+    return found;
+}
+
+
+static char*
+libgtlm_sysfs_cache_path()
+{
+    char *home = getenv("HOME");
+    if (home == NULL)
+        return NULL;
+
+    int len = strlen(home) + strlen(GTLM_SYSFS_CACHE) + 1;
+    char *path = (char*)malloc(len);
+    if (path)
+        snprintf(path, len, "%s%s", home, GTLM_SYSFS_CACHE);
+    return path;
+}
+
+
+int
+libgtlm_sysfs_open(const libgtlm_device_id **id)
+{
+    char hint[64] = "";
+    char *cache = libgtlm_sysfs_cache_path();
+    if (cache) {
+        FILE *file = fopen(cache, "re");
+        if (file) {
+            if (fgets(hint, sizeof(hint), file))
+                hint[strcspn(hint, "\n")] = '\0';
+            fclose(file);
+        }
+    }
+
+    libgtlm_sysfs_match match;
+    int fd = -1;
+    if (libgtlm_sysfs_find(hint, &match)) {
+        int rootDir = open(gSysfsRoot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rootDir >= 0) {
+            fd = openat(rootDir, match.node, O_RDWR | O_CLOEXEC);
+            close(rootDir);
+        }
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_DEBUG, "sysfs: %s at %s (%s), fd %d",
+            match.id->name, match.name,
+            strcmp(hint, match.name) == 0 ? "cached" : "scanned", fd);
+    }
+
+    if (fd >= 0) {
+        if (id)
+            *id = match.id;
+        if (cache && strcmp(hint, match.name) != 0) {
+            FILE *file = fopen(cache, "we");
+            if (file) {
+                fprintf(file, "%s\n", match.name);
+                fclose(file);
+            }
+        }
+    }
+
+    free(cache);
+    return fd;
+}
+
+
+int
+libgtlm_sysfs_error(int error)
+{
+    switch (error) {
+    case EACCES:
+    case EPERM:
+        return LIBUSB_ERROR_ACCESS;
+    case EBUSY:
+        return LIBUSB_ERROR_BUSY;
+    case ENOENT:
+    case ENODEV:
+        return LIBUSB_ERROR_NO_DEVICE;
+    case ENOMEM:
+        return LIBUSB_ERROR_NO_MEM;
+    case ETIMEDOUT:
+        return LIBUSB_ERROR_TIMEOUT;
+    case EPIPE:
+        return LIBUSB_ERROR_PIPE;
+    default:
+        return LIBUSB_ERROR_IO;
+    }
+}
+
+
+int
+libgtlm_sysfs_claim(int fd)
+{
+    // ENODATA: no driver bound. "usbfs" is another process's claim, which
+    // a disconnect would silently take away.
+    struct usbdevfs_getdriver driver;
+    memset(&driver, 0, sizeof(driver));
+    if (ioctl(fd, USBDEVFS_GETDRIVER, &driver) == 0) {
+        if (strcmp(driver.driver, "usbfs") == 0)
+            return LIBUSB_ERROR_BUSY;
+
+        struct usbdevfs_ioctl command = { 0, USBDEVFS_DISCONNECT, NULL };
+        if (ioctl(fd, USBDEVFS_IOCTL, &command) < 0 && errno != ENODATA)
+            return libgtlm_sysfs_error(errno);
+    } else if (errno != ENODATA)
+        return libgtlm_sysfs_error(errno);
+
+    unsigned int interface = 0;
+    if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &interface) < 0)
+        return libgtlm_sysfs_error(errno);
+    return LIBUSB_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_SYSFS_H__
+#define __LIBGTLM_SYSFS_H__
+
+#include "libgtlm.h"
+
+// libusb_wrap_sys_device() appeared in libusb 1.0.23
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000107)
+#define GTLM_HAVE_WRAP_SYS_DEVICE
+#endif
+
+// devices found through sysfs are opened by descriptor
+#if defined(__linux__) && defined(GTLM_HAVE_WRAP_SYS_DEVICE)
+#define GTLM_HAVE_SYSFS_OPEN
+#endif
+
+// Name of the last controller found, relative to $HOME.
+#define GTLM_SYSFS_CACHE             "/.gtlm-device"
+
+typedef struct libgtlm_sysfs_match {
+    const libgtlm_device_id *id;
+    char name[64];              // entry in bus/usb/devices, e.g. "1-4.2"
+    char node[32];              // usbfs node, e.g. "dev/bus/usb/001/005"
+} libgtlm_sysfs_match;
+
+// Controller discovery straight from sysfs (Linux only): reads the
+// idVendor/idProduct attributes under <root>/sys/bus/usb/devices instead
+// of building a libusb device list. The entry named by hint is checked
+// before scanning. The root defaults to "/"; tests can point it at a fake
+// tree holding both sys/ and dev/.
+void libgtlm_set_sysfs_root(const char *root);
+bool libgtlm_sysfs_find(const char *hint, libgtlm_sysfs_match *match);
+// Finds the controller, starting with the cached entry, and opens its
+// usbfs node; the cache is updated when the controller moved. Returns the
+// descriptor or -1 when sysfs has no match or the node cannot be opened.
+int libgtlm_sysfs_open(const libgtlm_device_id **id);
+// Detaches the kernel driver from interface 0 of a usbfs descriptor and
+// claims it, without going through libusb. LIBUSB_ERROR_BUSY when another
+// usbfs user holds it; that claim is never broken.
+int libgtlm_sysfs_claim(int fd);
+// Maps an errno from usbfs or the filesystem to a libusb_error code.
+int libgtlm_sysfs_error(int error);
+
+#endif // __LIBGTLM_SYSFS_H__
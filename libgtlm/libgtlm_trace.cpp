@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include "libgtlm.h"
+
+// Fields are relaxed atomics: a flush may read a slot while its thread
+// overwrites it, and tells so from the buffer's claimed count.
+typedef struct libgtlm_trace_event {
+    std::atomic<const char*> category;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> start;        // libgtlm_time_ns()
+    std::atomic<uint64_t> end;
+} libgtlm_trace_event;
+
+// Ring written only by its thread: event n goes to slot n % size. claimed
+// moves before a slot is overwritten and count after it is filled, so a
+// reader knows which of the copies it made are whole.
+typedef struct libgtlm_trace_buffer {
+    std::atomic<uint64_t> claimed;
+    std::atomic<uint64_t> count;
+    std::atomic<const char*> name;
+    uint32_t id;
+    bool idle;                  // its thread exited; free for the next one
+    struct libgtlm_trace_buffer *next;
+    libgtlm_trace_event events[GTLM_TRACE_BUFFER_SIZE];
+} libgtlm_trace_buffer;
+
+// Gives the buffer back when its thread exits. Events stay in it, and in
+// the trace, until a new thread takes it over.
+typedef struct libgtlm_trace_owner {
+    libgtlm_trace_buffer *buffer;
+    ~libgtlm_trace_owner();
+} libgtlm_trace_owner;
+
+std::atomic<bool> libgtlm_tracing(false);
+
+// Buffers are never freed, only reused: flushes walk all of them, and they
+// are only allocated while tracing.
+static libgtlm_trace_buffer *gTraceBuffers = NULL;
+static uint32_t gTraceThreads = 0;
+static std::atomic<uint64_t> gTraceDropped(0);
+static thread_local libgtlm_trace_owner gTraceOwner = { NULL };
+static std::mutex gTraceLock;           // flushes and the buffer list
+static char *gTracePath = NULL;
+
+
+libgtlm_trace_owner::~libgtlm_trace_owner()
+{
+    if (buffer == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(gTraceLock);
+    buffer->idle = true;
+}
+
+
+static libgtlm_trace_buffer*
+libgtlm_trace_buffer_get()
+{
+    if (gTraceOwner.buffer)
+        return gTraceOwner.buffer;
+
+    // the lock keeps flushes away from a buffer being reset
+    std::lock_guard<std::mutex> lock(gTraceLock);
+    libgtlm_trace_buffer *buffer = gTraceBuffers;
+    while (buffer && !buffer->idle)
+        buffer = buffer->next;
+
+    if (buffer == NULL) {
+        buffer = new (std::nothrow) libgtlm_trace_buffer;
+        if (buffer == NULL)
+            return NULL;
+        buffer->next = gTraceBuffers;
+        gTraceBuffers = buffer;
+    }
+
+    buffer->claimed = 0;
+    buffer->count = 0;
+    buffer->name = NULL;
+    buffer->id = ++gTraceThreads;
+    buffer->idle = false;
+    gTraceOwner.buffer = buffer;
+    return buffer;
+}
+
+
+void
+libgtlm_trace_span(const char *category, const char *name, uint64_t start,
+    uint64_t end)
+{
+    if (!libgtlm_trace_enabled())
+        return;
+
+    libgtlm_trace_buffer *buffer = libgtlm_trace_buffer_get();
+    if (buffer == NULL)
+        return;
+
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    if (count >= GTLM_TRACE_BUFFER_SIZE)
+        gTraceDropped.fetch_add(1, std::memory_order_relaxed);
+
+    libgtlm_trace_event *event =
+        &buffer->events[count % GTLM_TRACE_BUFFER_SIZE];
+    buffer->claimed.store(count + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event->category.store(category, std::memory_order_relaxed);
+    event->name.store(name, std::memory_order_relaxed);
+    event->start.store(start, std::memory_order_relaxed);
+    event->end.store(end, std::memory_order_relaxed);
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+
+void
+libgtlm_trace_thread_name(const char *name)
+{
+    if (!libgtlm_trace_enabled())
+        return;
+
+    libgtlm_trace_buffer *buffer = libgtlm_trace_buffer_get();
+    if (buffer)
+        buffer->name.store(name, std::memory_order_release);
+}
+
+
+uint64_t
+libgtlm_dropped_trace_events()
+{
+    return gTraceDropped.load(std::memory_order_relaxed);
+}
+
+
+bool
+libgtlm_trace_flush()
+{
+    std::lock_guard<std::mutex> lock(gTraceLock);
+    if (gTracePath == NULL)
+        return false;
+
+    FILE *file = fopen(gTracePath, "w");
+    if (file == NULL)
+        return false;
+
+    // timestamps are in microseconds; keep the nanoseconds as decimals
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (libgtlm_trace_buffer *buffer = gTraceBuffers; buffer;
+            buffer = buffer->next) {
+        const char *name = buffer->name.load(std::memory_order_acquire);
+        if (name) {
+            fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n",
+                buffer->id, name);
+            first = false;
+        }
+
+        // the last size events, skipping any the thread overwrote meanwhile
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t i = count > GTLM_TRACE_BUFFER_SIZE
+            ? count - GTLM_TRACE_BUFFER_SIZE : 0;
+        for (; i < count; i++) {
+            const libgtlm_trace_event *event =
+                &buffer->events[i % GTLM_TRACE_BUFFER_SIZE];
+            const char *category =
+                event->category.load(std::memory_order_relaxed);
+            const char *eventName =
+                event->name.load(std::memory_order_relaxed);
+            uint64_t start = event->start.load(std::memory_order_relaxed);
+            uint64_t end = event->end.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (buffer->claimed.load(std::memory_order_relaxed)
+                > i + GTLM_TRACE_BUFFER_SIZE)
+                continue;
+
+            fprintf(file, "%s{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\","
+                "\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+                first ? "" : ",\n", category, eventName, buffer->id,
+                (unsigned long long)(start / 1000), (unsigned)(start % 1000),
+                (unsigned long long)((end - start) / 1000),
+                (unsigned)((end - start) % 1000));
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+
+static void
+libgtlm_trace_exit()
+{
+    libgtlm_trace_stop();
+}
+
+
+bool
+libgtlm_trace_start(const char *path)
+{
+    if (path == NULL)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(gTraceLock);
+        if (gTracePath)
+            return false;
+        gTracePath = strdup(path);
+        if (gTracePath == NULL)
+            return false;
+    }
+    atexit(libgtlm_trace_exit);
+    libgtlm_tracing.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+
+void
+libgtlm_trace_stop()
+{
+    if (!libgtlm_tracing.exchange(false, std::memory_order_relaxed))
+        return;
+
+    libgtlm_trace_flush();
+    if (libgtlm_dropped_trace_events())
+        GTLM_LOG(SUBSYSTEM_CORE, LEVEL_WARN, "trace: %llu events overwritten",
+            (unsigned long long)libgtlm_dropped_trace_events());
+}
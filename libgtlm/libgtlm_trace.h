@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_TRACE_H__
+#define __LIBGTLM_TRACE_H__
+
+#include <atomic>
+#include <stdint.h>
+
+// Events kept per thread; older ones are overwritten and counted as dropped.
+#define GTLM_TRACE_BUFFER_SIZE       65536
+
+extern std::atomic<bool> libgtlm_tracing;
+
+inline bool
+libgtlm_trace_enabled()
+{
+    return libgtlm_tracing.load(std::memory_order_relaxed);
+}
+
+// Spans take libgtlm_time_ns() stamps; begin gives 0 while tracing is off
+// so the end is skipped too. Names and categories must be string literals
+// or otherwise outlive the trace.
+#define GTLM_TRACE_BEGIN() \
+    (libgtlm_trace_enabled() ? libgtlm_time_ns() : 0)
+
+#define GTLM_TRACE_END(category, name, start) \
+    do { \
+        if (start) \
+            libgtlm_trace_span((category), (name), (start), libgtlm_time_ns()); \
+    } while (0)
+
+// Opt-in timeline of library activity in Trace Event Format JSON, for
+// chrome://tracing or ui.perfetto.dev. Every thread appends to its own
+// ring, taken on its first event and handed to a later thread after it
+// exits, with no lock or system call; flushing reads the newest events of
+// each ring while the owners keep writing. One trace per process: start
+// enables it and flushes at exit.
+bool libgtlm_trace_start(const char *path);
+// Stops recording and writes the file.
+void libgtlm_trace_stop();
+// Writes everything recorded so far, e.g. from a signal the loop delivers.
+bool libgtlm_trace_flush();
+void libgtlm_trace_span(const char *category, const char *name,
+    uint64_t start, uint64_t end);
+// Shown as the calling thread's name in the viewer.
+void libgtlm_trace_thread_name(const char *name);
+uint64_t libgtlm_dropped_trace_events();
+
+#endif // __LIBGTLM_TRACE_H__
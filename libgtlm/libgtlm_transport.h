@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2010 by Artur Wyszynski <harakash@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+#ifndef __LIBGTLM_TRANSPORT_H__
+#define __LIBGTLM_TRANSPORT_H__
+
+#include "libgtlm_protocol.h"
+
+typedef struct libgtlm_transport libgtlm_transport;
+
+// How requests reach a controller. The library writes each request in
+// place into *request and calls transfer(); when readBack is set the IN
+// stage follows and *reply holds the controller's answer on success.
+// transfer() returns a negative libusb_error code on failure.
+//
+// The libusb transfer pool is the default transport (libgtlm_pool.h);
+// simulators and test wrappers provide their own and are attached with
+// libgtlm_open_transport().
+struct libgtlm_transport {
+    libgtlm_packet *request;
+    const libgtlm_packet *reply;
+    int (*transfer)(libgtlm_transport *transport, bool readBack);
+};
+
+#endif // __LIBGTLM_TRANSPORT_H__